@@ -0,0 +1,365 @@
+#include "aot.h"
+
+/**
+* C expression for each function select over the A and B buses
+*/
+static const char* F_EXPR[16] = {
+  "0",
+  "1",
+  "a",
+  "b",
+  "a + b",
+  "a - b",
+  "a * b",
+  "b == 0 ? 0xffff : a / b",
+  "~a",
+  "a & b",
+  "a | b",
+  "-a",
+  "a >> 1",
+  "a << 1",
+  "(a >> 1) | (a & 0x8000)",
+  "a"
+};
+
+static const char* CONST_NAMES[8] = { "0", "ca", "cb", "cc", "0", "0", "0", "0" };
+
+/**
+* Per-address facts about the control store needed to lay out blocks
+*/
+typedef struct Translation
+{
+  const MicroInstruction* rom;
+  uint32_t depth;
+  RomGeometry geom;
+  uint32_t fetch_addr;
+  uint32_t dispatch[OPCODE_COUNT];  // entry address of each opcode
+  
+  uint8_t* reachable;
+  uint8_t* leader;          // starts a basic block
+  uint8_t* referenced;      // target of a goto, so needs a label
+}
+Translation;
+
+static MicroInstruction word_at( const Translation* t, uint32_t addr )
+{
+  return t->rom[addr];
+}
+
+static bool is_jump( const Translation* t, uint32_t addr )
+{
+  return (word_at( t, addr ) & t->geom.mode) != 0;
+}
+
+static uint32_t jump_target( const Translation* t, uint32_t addr )
+{
+  uint32_t target = minstr_get( word_at( t, addr ), t->geom.next_addr );
+  return target < t->depth ? target : 0;
+}
+
+static uint32_t jump_cond( const Translation* t, uint32_t addr )
+{
+  return minstr_get( word_at( t, addr ), t->geom.cond );
+}
+
+static uint32_t next_addr( const Translation* t, uint32_t addr )
+{
+  return addr + 1 < t->depth ? addr + 1 : 0;
+}
+
+/**
+* Marks everything reachable from the idle word and the opcode entries,
+* and the addresses that start a basic block
+*/
+static void find_blocks( Translation* t )
+{
+  uint32_t* work = malloc( (t->depth + 16) * sizeof(uint32_t) );
+  uint32_t work_len = 0;
+  
+  #define VISIT( addr, ref ) \
+    do \
+    { \
+      uint32_t a_ = (addr); \
+      t->leader[a_] |= (ref); \
+      t->referenced[a_] |= (ref); \
+      if( !t->reachable[a_] ) \
+      { \
+        t->reachable[a_] = 1; \
+        work[work_len++] = a_; \
+      } \
+    } \
+    while( 0 )
+  
+  VISIT( t->fetch_addr, 1 );
+  
+  while( work_len > 0 )
+  {
+    uint32_t addr = work[--work_len];
+    
+    if( addr == t->fetch_addr )
+    {
+      // dispatch to every opcode's entry
+      uint32_t op;
+      for( op = 1; op < OPCODE_COUNT; op++ )
+      {
+        VISIT( t->dispatch[op], 1 );
+      }
+    }
+    else if( is_jump( t, addr ) )
+    {
+      VISIT( jump_target( t, addr ), 1 );
+      if( jump_cond( t, addr ) != 0 )
+      {
+        // the fall through starts a block, but is not jumped to
+        VISIT( next_addr( t, addr ), 0 );
+        t->leader[next_addr( t, addr )] = 1;
+      }
+    }
+    else
+    {
+      uint32_t next = next_addr( t, addr );
+      
+      // falling off the end wraps around with a goto
+      VISIT( next, next == 0 ? 1 : 0 );
+    }
+  }
+  
+  #undef VISIT
+  
+  free( work );
+}
+
+/**
+* Number of words in the block starting at addr
+*/
+static uint32_t block_length( const Translation* t, uint32_t addr )
+{
+  uint32_t len = 0;
+  while( true )
+  {
+    len++;
+    if( is_jump( t, addr ) || addr == t->fetch_addr )
+    {
+      return len;
+    }
+    addr++;
+    if( addr >= t->depth || t->leader[addr] )
+    {
+      return len;
+    }
+  }
+}
+
+static void write_microop( FILE* out, MicroInstruction w )
+{
+  int aa = minstr_get( w, M_AA );
+  int ba = minstr_get( w, M_BA );
+  int fs = minstr_get( w, M_FS );
+  int da = minstr_get( w, M_DA );
+  bool rw = minstr_get( w, M_RW );
+  bool mw = minstr_get( w, M_MW );
+  bool mf = minstr_get( w, M_MF );
+  
+  fprintf( out, "  { uint16_t a = r%d; uint16_t b = ", aa );
+  if( minstr_get( w, M_MB ) )
+  {
+    fprintf( out, "%s;", CONST_NAMES[ba] );
+  }
+  else
+  {
+    fprintf( out, "r%d;", ba );
+  }
+  fprintf( out, " uint16_t f = (uint16_t)(%s); (void)a; (void)b;", F_EXPR[fs] );
+  
+  if( rw && mf )
+  {
+    fprintf( out, " uint16_t data = mem[a];" );
+  }
+  if( mw )
+  {
+    fprintf( out, " mem[a] = b;" );
+  }
+  if( rw )
+  {
+    fprintf( out, " r%d = %s;", da, mf ? "data" : "f" );
+  }
+  fprintf( out, " flags = DD_FLAGS( f ); }\n" );
+}
+
+void write_c_translation( FILE* out, const MicroInstruction* rom,
+                          uint32_t rom_len, const RomGeometry* geom,
+                          uint32_t fetch_addr, const uint32_t* dispatch,
+                          const char* name )
+{
+  Translation t;
+  t.depth = geom->depth;
+  t.geom = *geom;
+  t.fetch_addr = fetch_addr;
+  
+  // entries past the end land on address 0, as in the simulator
+  uint32_t op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    uint32_t entry = dispatch != NULL ? dispatch[op] : op << OPCODE_SLOT_BITS;
+    t.dispatch[op] = entry < t.depth ? entry : 0;
+  }
+  
+  // pad the image out to the full depth, unused words are nops
+  MicroInstruction* words = calloc( t.depth, sizeof(MicroInstruction) );
+  t.reachable = calloc( t.depth, 1 );
+  t.leader = calloc( t.depth, 1 );
+  t.referenced = calloc( t.depth, 1 );
+  if( words == NULL || t.reachable == NULL || t.leader == NULL || t.referenced == NULL )
+  {
+    fprintf( out, "#error out of memory translating the control store\n" );
+    free( words );
+    free( t.reachable );
+    free( t.leader );
+    free( t.referenced );
+    return;
+  }
+  memcpy( words, rom, (rom_len < t.depth ? rom_len : t.depth) * sizeof(MicroInstruction) );
+  t.rom = words;
+  
+  find_blocks( &t );
+  
+  int addr_digits = (geom->addr_bits + 3) / 4;
+  
+  fprintf( out,
+    "/* DDmini control store translated to C by dda, do not edit */\n"
+    "\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "#ifndef DD_MACHINE_DEFINED\n"
+    "#define DD_MACHINE_DEFINED\n"
+    "typedef struct DdMachine\n"
+    "{\n"
+    "  uint16_t regs[8];\n"
+    "  uint8_t flags;\n"
+    "  uint32_t pc;\n"
+    "  uint64_t cycles;\n"
+    "  uint64_t instructions;\n"
+    "}\n"
+    "DdMachine;\n"
+    "#endif\n"
+    "\n"
+    "#define DD_FLAGS( f ) ((f) == 0 ? %d : ((f) & 0x8000) ? %d : %d)\n"
+    "\n"
+    "int %s_run( DdMachine* m, uint16_t* mem,\n"
+    "    const uint16_t* program, uint32_t program_len, uint64_t max_cycles )\n"
+    "{\n"
+    "  uint16_t r0 = m->regs[0], r1 = m->regs[1], r2 = m->regs[2], r3 = m->regs[3];\n"
+    "  uint16_t r4 = m->regs[4], r5 = m->regs[5], r6 = m->regs[6], r7 = m->regs[7];\n"
+    "  uint16_t ca = 0, cb = 0, cc = 0;\n"
+    "  uint8_t flags = m->flags;\n"
+    "  uint32_t pc = m->pc;\n"
+    "  uint64_t cycles = 0;\n"
+    "  uint64_t instructions = 0;\n"
+    "  int status;\n"
+    "  (void)ca; (void)cb; (void)cc;\n"
+    "\n",
+    COND_Z, COND_N, COND_P, name );
+  
+  fprintf( out, "  goto L_%0*X;\n\n", addr_digits, fetch_addr );
+  
+  uint32_t addr = 0;
+  while( addr < t.depth )
+  {
+    if( !t.reachable[addr] )
+    {
+      addr++;
+      continue;
+    }
+    
+    // block header
+    uint32_t len = block_length( &t, addr );
+    if( t.referenced[addr] )
+    {
+      fprintf( out, "L_%0*X:\n", addr_digits, addr );
+    }
+    fprintf( out, "  if( cycles >= max_cycles ) goto limit;\n" );
+    fprintf( out, "  cycles += %u;\n", len );
+    
+    uint32_t i;
+    for( i = 0; i < len; i++, addr++ )
+    {
+      MicroInstruction w = words[addr];
+      fprintf( out, "  /* %0*X */\n", addr_digits, addr );
+      
+      if( addr == fetch_addr && (w & geom->mode) )
+      {
+        // a jump in the idle word is overridden by the dispatch
+      }
+      else if( w & geom->mode )
+      {
+        uint32_t cond = minstr_get( w, geom->cond );
+        uint32_t target = minstr_get( w, geom->next_addr );
+        if( target >= t.depth )
+        {
+          target = 0;
+        }
+        if( cond == 0 )
+        {
+          fprintf( out, "  goto L_%0*X;\n", addr_digits, target );
+        }
+        else
+        {
+          fprintf( out, "  if( flags & %u ) goto L_%0*X;\n", cond, addr_digits, target );
+        }
+      }
+      else
+      {
+        write_microop( out, w );
+      }
+      
+      if( addr == fetch_addr )
+      {
+        fprintf( out,
+          "  if( pc >= program_len ) { status = %d; goto done; }\n"
+          "  {\n"
+          "    uint16_t ir = program[pc++];\n"
+          "    if( (ir >> 12) == 0 ) { status = %d; goto done; }\n"
+          "    ca = (ir >> 8) & 0xf; cb = (ir >> 4) & 0xf; cc = ir & 0xf;\n"
+          "    instructions++;\n"
+          "    switch( ir >> 12 )\n"
+          "    {\n",
+          SIM_END, SIM_HALT );
+        for( op = 1; op < OPCODE_COUNT; op++ )
+        {
+          fprintf( out, "      case %u: goto L_%0*X;\n",
+                   op, addr_digits, t.dispatch[op] );
+        }
+        fprintf( out, "    }\n  }\n" );
+      }
+    }
+    
+    // fall through, unless the block ended in a jump away or a dispatch
+    uint32_t last = addr - 1;
+    bool jumps_away = last == fetch_addr
+                      || ((words[last] & geom->mode) && minstr_get( words[last], geom->cond ) == 0);
+    if( !jumps_away && addr >= t.depth )
+    {
+      fprintf( out, "  goto L_%0*X;\n", addr_digits, 0 );
+    }
+    fprintf( out, "\n" );
+  }
+  
+  fprintf( out,
+    "limit:\n"
+    "  status = %d;\n"
+    "done:\n"
+    "  m->regs[0] = r0; m->regs[1] = r1; m->regs[2] = r2; m->regs[3] = r3;\n"
+    "  m->regs[4] = r4; m->regs[5] = r5; m->regs[6] = r6; m->regs[7] = r7;\n"
+    "  m->flags = flags;\n"
+    "  m->pc = pc;\n"
+    "  m->cycles += cycles;\n"
+    "  m->instructions += instructions;\n"
+    "  return status;\n"
+    "}\n",
+    SIM_CYCLE_LIMIT );
+  
+  free( words );
+  free( t.reachable );
+  free( t.leader );
+  free( t.referenced );
+}
@@ -0,0 +1,44 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "sim.h"
+
+/**
+* Ahead-of-time translation of a control store into C.
+*
+* Each basic block of the ROM (a straight run of micro operations up to
+* a microsequencing word or the next jump target) becomes a run of C
+* statements, and PZN jumps become native branches, so the host compiler
+* can optimise the whole control store.  The generated file is self
+* contained and defines:
+
+  typedef struct DdMachine
+  {
+    uint16_t regs[8];
+    uint8_t flags;
+    uint32_t pc;            // index of the next macro instruction
+    uint64_t cycles;
+    uint64_t instructions;
+  }
+  DdMachine;
+
+  int NAME_run( DdMachine* m, uint16_t* mem,
+                const uint16_t* program, uint32_t program_len,
+                uint64_t max_cycles );
+
+* NAME_run starts at the idle word and behaves like sim_run, returning
+* one of the SIM_* statuses, except that the cycle limit is only checked
+* at the start of each basic block.  mem is SIM_MEM_WORDS long.
+*/
+
+/**
+* Writes the C translation of the ROM to out_file.  Control dispatches
+* through the mapping ROM (or the fixed slots if dispatch is NULL) after
+* the word at fetch_addr, as in the simulator.
+*/
+void write_c_translation( FILE* out_file, const MicroInstruction* rom,
+                          uint32_t rom_len, const RomGeometry* geom,
+                          uint32_t fetch_addr, const uint32_t* dispatch,
+                          const char* name );
+
+#endif
@@ -5,46 +5,106 @@
 * Tokenizer
 */
 
-void error( char* msg, LexState state )
+char* load_source( FILE* in, size_t* len )
 {
-  printf("Error: %s @ line %d col %d \n", msg, state->line, state->column);
-  exit(1);
+  size_t capacity = 1 << 16;
+  size_t size = 0;
+  char* buf = malloc( capacity );
+  if( buf == NULL )
+  {
+    return NULL;
+  }
+  
+  // read in large blocks until EOF; this works for pipes as well as files
+  size_t n;
+  while( (n = fread( buf + size, 1, capacity - size, in )) > 0 )
+  {
+    size += n;
+    if( size == capacity )
+    {
+      capacity *= 2;
+      char* grown = realloc( buf, capacity );
+      if( grown == NULL )
+      {
+        free( buf );
+        return NULL;
+      }
+      buf = grown;
+    }
+  }
+  
+  if( ferror( in ) )
+  {
+    free( buf );
+    return NULL;
+  }
+
+  *len = size;
+  return buf;
 }
 
-int read( LexState state )
+void source_position( LexState state, int* line, int* column )
 {
-  int c = fgetc( state->in );
-  if( c == '\n' )
+  const char* line_start = state->src;
+  const char* c;
+  int lines = 1;
+  for( c = state->src; c < state->cur && c < state->src_end; c++ )
   {
-    state->line++;
-    state->column = 1;
+    if( *c == '\n' )
+    {
+      lines++;
+      line_start = c + 1;
+    }
   }
-  else
+  *line = lines;
+  *column = (int)(c - line_start) + 1;
+}
+
+void error( char* msg, LexState state )
+{
+  source_position( state, &state->error_line, &state->error_column );
+  snprintf( state->error_msg, sizeof(state->error_msg), "%s", msg );
+  
+  if( state->on_error != NULL )
   {
-    state->column++;
+    longjmp( *state->on_error, 1 );
   }
-  return c;
+  
+  printf("Error: %s @ line %d col %d \n",
+         state->error_msg, state->error_line, state->error_column);
+  exit(1);
 }
 
-void unread( int c, LexState state )
+/**
+* The character level readers walk a pointer over the in-memory source.
+* They are kept static so the compiler can inline them into the lexer.
+*/
+
+static int read( LexState state )
 {
-  if( c == '\n' )
+  if( state->cur < state->src_end )
   {
-    state->line--;
-    state->column = 0;
+    return (unsigned char)*state->cur++;
   }
-  else
+  return -1;
+}
+
+static void unread( int c, LexState state )
+{
+  // reading at EOF does not advance, so there is nothing to push back
+  if( c != -1 )
   {
-    state->column--;
+    state->cur--;
   }
-  ungetc( c, state->in );
 }
 
-int peek( LexState state )
+static int peek( LexState state )
 {
-  int c = read( state );
-  unread( c, state );
-  return c;
+  if( state->cur < state->src_end )
+  {
+    return (unsigned char)*state->cur;
+  }
+  return -1;
 }
 
 void expect( int expected, LexState state )
@@ -52,31 +112,37 @@ void expect( int expected, LexState state )
   int c = read( state );
   if( c != expected )
   {
-    printf( "Expected '%c', found '%c' @ line %d col %d", 
-            expected, c, state->line, state->column );
-    error( "", state );
+    char msg[32];
+    sprintf( msg, "Expected '%c', found '%c'", expected, c );
+    error( msg, state );
   }
   return;
 }
 
 void skip_ws( LexState state )
 {
-  int c = -1;
-  do
+  const char* c = state->cur;
+  const char* end = state->src_end;
+  while( c < end )
   {
-    c = read( state );
-    if( c == ';' )
+    if( *c == ';' )
     {
       // ignore the rest of the line
-      while( c != -1 && c != '\n' )
+      while( c < end && *c != '\n' )
       {
-        c = read( state );
+        c++;
       }
     }
-  }  
-  while( isspace(c) );
-  
-  unread( c, state );
+    else if( isspace( (unsigned char)*c ) )
+    {
+      c++;
+    }
+    else
+    {
+      break;
+    }
+  }
+  state->cur = c;
 }
 
 bool is_symbol_char( int c )
@@ -87,31 +153,66 @@ bool is_symbol_char( int c )
 void read_symbol( LexState state )
 {
   // collect
-  state->buf_len = 0;
+  const char* c = state->cur;
+  const char* end = state->src_end;
+  int len = 0;
   
-  int c = read( state );
-  while( isalpha( c ) )
+  // FNV-1a hash of the symbol, so label lookups don't have to rehash it
+  uint32_t hash = 2166136261u;
+  
+  // packed bytes for keyword lookup
+  uint64_t key = 0;
+  
+  // a leading '.' is allowed so directives can be read as one symbol
+  while( c < end && (len == 0 ? is_symbol_char( (unsigned char)*c )
+                              : isalpha( (unsigned char)*c )) )
   {
-    c = tolower( c );
-
-    if( state->buf_len >= BUF_SIZE )
+    if( len >= BUF_SIZE - 1 )
     {
+      state->cur = c;
       error( "Maximum symbol length exceeded", state );
     }
-    state->buf[state->buf_len] = c;
-    state->buf_len++;
-  
-    c = read( state );
+    char lower = tolower( (unsigned char)*c );
+    state->buf[len] = lower;
+    hash = (hash ^ (uint8_t)lower) * 16777619u;
+    if( len < 8 )
+    {
+      key |= (uint64_t)(uint8_t)lower << (len * 8);
+    }
+    len++;
+    c++;
   }
-  unread( c, state );
+  state->cur = c;
   
   // terminate string
-  state->buf[state->buf_len] = 0;
+  state->buf_len = len;
+  state->buf_hash = hash;
+  state->buf_key = len <= 8 ? key : 0;
+  state->buf[len] = 0;
+}
+
+/**
+* Looks up the symbol in the lexer buffer in the KEYWORDS table.
+* Returns false if it is not a reserved word.
+*/
+static bool find_keyword( LexState state, Token* token )
+{
+  switch( state->buf_key )
+  {
+#define KEYWORD_CASE( name, key, type, value, flags ) \
+    case key: *token = (Token){ type, value, flags }; return true;
+    
+    KEYWORDS( KEYWORD_CASE )
+
+#undef KEYWORD_CASE
+  }
+  return false;
 }
 
 Token read_token( LexState state )
 {
   skip_ws( state );
+  state->token_start = state->cur;
   
   int c = read( state );
   if( c == -1 )
@@ -146,7 +247,8 @@ Token read_token( LexState state )
       
       return (Token){ TT_ADDR, address };
     }
-    unread( c, state );
+    
+    // otherwise it is a symbol starting with x, read below
   }
   else if( c == '[' )
   {
@@ -183,11 +285,13 @@ Token read_token( LexState state )
   else if( c == '.' )
   {
     // directive
+    unread( c, state );
     read_symbol( state );
     
-    if( strcmp( "org", state->buf ) == 0 )
+    Token dir;
+    if( find_keyword( state, &dir ) && dir.type == TT_DIR )
     {
-      return (Token){ TT_DIR, DR_ORG };
+      return dir;
     }
   }
   
@@ -198,55 +302,11 @@ Token read_token( LexState state )
     
     read_symbol( state );
     
-    if( state->buf_len == 1 )
-    {
-      int val = state->buf[0];
-      switch( val )
-      {
-        case 'a': return (Token){ TT_CONST, CONST_A };
-        case 'b': return (Token){ TT_CONST, CONST_B };
-        case 'c': return (Token){ TT_CONST, CONST_C };
-      }
-    }
-    
-    // see if the symbol collected is a mnemonic
-    int i;
-    for( i=0; i<MNEMONIC_COUNT; i++ )
+    // mnemonics, jmp condition variants and the A|B|C constants
+    Token keyword;
+    if( find_keyword( state, &keyword ) )
     {
-      if( strcmp( MNEMONICS[i], state->buf ) == 0 )
-      {
-        // i will be the ordinal of the 
-        return (Token){ TT_INSTR, i };
-      }
-    }
-    
-    if( state->buf_len >= 3 )
-    {
-      uint8_t flags = 0;
-      if( state->buf[0] == 'j'
-        && state->buf[1] == 'm'
-        && state->buf[2] == 'p' )
-      {
-        int i = 3;
-        if( i < state->buf_len && state->buf[i] == 'p' )
-        {
-          flags |= COND_P;
-          i++;
-        }
-        
-        if( i < state->buf_len && state->buf[i] == 'z' )
-        {
-          flags |= COND_Z;
-          i++;
-        }
-        
-        if( i < state->buf_len && state->buf[i] == 'n' )
-        {
-          flags |= COND_N;
-          i++;
-        }
-        return (Token){ TT_INSTR, MN_JMP, flags };
-      }
+      return keyword;
     }
     
     // if not, assume it's a label
@@ -290,7 +350,7 @@ uint16_t read_hex( LexState state )
       }
       
       value = value << 4;
-
+      
       switch( c )
       {
         case '0': break;
@@ -326,54 +386,415 @@ uint16_t read_hex( LexState state )
     unread( c, state );
     return value;
   }
-
+  
   error( "Expected hex char", state );
   return 0;
 }
 
-void add_label( char* label_name, uint8_t pos, LexState state )
+void* arena_alloc( Arena* arena, size_t size )
 {
-  //printf("label: %s \n", label_name);
-  Label* label = malloc( sizeof(Label) );
-  strncpy( label->label, label_name, strlen(label_name) );
-  label->pos = pos;
+  // keep every allocation suitably aligned for any of the label structs
+  size = (size + 7) & ~(size_t)7;
+  
+  ArenaBlock* block = arena->current;
+  while( block != NULL && block->used + size > block->size )
+  {
+    // blocks after the current one are left over from before a reset
+    block = block->next;
+  }
+  
+  if( block == NULL )
+  {
+    size_t block_size = 1 << 16;
+    if( size > block_size )
+    {
+      block_size = size;
+    }
+    block = malloc( sizeof(ArenaBlock) + block_size );
+    if( block == NULL )
+    {
+      return NULL;
+    }
+    block->size = block_size;
+    block->used = 0;
+    
+    // link the new block in after the current one
+    if( arena->current == NULL )
+    {
+      block->next = arena->head;
+      arena->head = block;
+    }
+    else
+    {
+      block->next = arena->current->next;
+      arena->current->next = block;
+    }
+  }
   
-  // make the new label the root of the state.labels linked list
-  label->next = state->labels;
-  state->labels = label;
+  arena->current = block;
+  void* ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void arena_reset( Arena* arena )
+{
+  ArenaBlock* block;
+  for( block = arena->head; block != NULL; block = block->next )
+  {
+    block->used = 0;
+  }
+  arena->current = arena->head;
+}
+
+void arena_free( Arena* arena )
+{
+  ArenaBlock* block = arena->head;
+  while( block != NULL )
+  {
+    ArenaBlock* next = block->next;
+    free( block );
+    block = next;
+  }
+  arena->head = NULL;
+  arena->current = NULL;
 }
 
 /**
-* Returns either the address associated with the given label,
-* or -1 if the label was not found
+* Arena version of realloc, the old storage is simply abandoned until
+* the next reset
 */
-int find_label( char* label_name, LexState state )
+static void* arena_grow( Arena* arena, void* ptr, size_t old_size, size_t new_size )
 {
-  Label* label = state->labels;
-  while( label != NULL )
+  void* grown = arena_alloc( arena, new_size );
+  if( grown != NULL && ptr != NULL )
   {
-    if( strcmp( label->label, label_name ) == 0 )
+    memcpy( grown, ptr, old_size );
+  }
+  return grown;
+}
+
+static void grow_label_slots( LexState state )
+{
+  LabelTable* table = &state->labels;
+  uint32_t slot_count = table->slots == NULL ? 64 : (table->slot_mask + 1) * 2;
+  uint32_t* slots = arena_alloc( &state->arena, slot_count * sizeof(uint32_t) );
+  if( slots == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  memset( slots, 0, slot_count * sizeof(uint32_t) );
+  
+  // reinsert every label; hashes are stored so nothing is rehashed
+  uint32_t mask = slot_count - 1;
+  uint32_t id;
+  for( id = 0; id < table->count; id++ )
+  {
+    uint32_t slot = table->labels[id].hash & mask;
+    while( slots[slot] != 0 )
+    {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = id + 1;
+  }
+  
+  table->slots = slots;
+  table->slot_mask = mask;
+}
+
+uint32_t intern_label( const char* name, int len, uint32_t hash, LexState state )
+{
+  LabelTable* table = &state->labels;
+  
+  // keep the load factor at or below one half
+  if( table->slots == NULL || (table->count + 1) * 2 > table->slot_mask + 1 )
+  {
+    grow_label_slots( state );
+  }
+  
+  uint32_t slot = hash & table->slot_mask;
+  while( table->slots[slot] != 0 )
+  {
+    uint32_t id = table->slots[slot] - 1;
+    Label* label = &table->labels[id];
+    if( label->hash == hash
+        && memcmp( table->names + label->name, name, len + 1 ) == 0 )
+    {
+      return id;
+    }
+    slot = (slot + 1) & table->slot_mask;
+  }
+  
+  // not seen before, intern the name and add an undefined label
+  if( table->count == table->capacity )
+  {
+    uint32_t capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+    table->labels = arena_grow( &state->arena, table->labels,
+                                table->capacity * sizeof(Label),
+                                capacity * sizeof(Label) );
+    if( table->labels == NULL )
+    {
+      error( "Out of memory", state );
+    }
+    table->capacity = capacity;
+  }
+  if( table->names_len + len + 1 > table->names_capacity )
+  {
+    uint32_t capacity = table->names_capacity == 0 ? 1024 : table->names_capacity;
+    while( table->names_len + len + 1 > capacity )
+    {
+      capacity *= 2;
+    }
+    table->names = arena_grow( &state->arena, table->names,
+                               table->names_len, capacity );
+    if( table->names == NULL )
+    {
+      error( "Out of memory", state );
+    }
+    table->names_capacity = capacity;
+  }
+  
+  uint32_t id = table->count++;
+  Label* label = &table->labels[id];
+  label->hash = hash;
+  label->name = table->names_len;
+  label->pos = -1;
+  label->instr = 0;
+  label->fixups = NULL;
+  
+  memcpy( table->names + table->names_len, name, len );
+  table->names[table->names_len + len] = 0;
+  table->names_len += len + 1;
+  
+  table->slots[slot] = id + 1;
+  return id;
+}
+
+int lookup_label( const char* name, LexState state )
+{
+  LabelTable* table = &state->labels;
+  if( table->slots == NULL )
+  {
+    return -1;
+  }
+  
+  // same FNV-1a hash as read_symbol
+  uint32_t hash = 2166136261u;
+  size_t len = strlen( name );
+  size_t i;
+  for( i = 0; i < len; i++ )
+  {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  
+  uint32_t slot = hash & table->slot_mask;
+  while( table->slots[slot] != 0 )
+  {
+    Label* label = &table->labels[table->slots[slot] - 1];
+    if( label->hash == hash
+        && memcmp( table->names + label->name, name, len + 1 ) == 0 )
     {
       return label->pos;
     }
-    
-    label = label->next;
+    slot = (slot + 1) & table->slot_mask;
   }
   return -1;
 }
 
 /**
-* Add the given instruction to the list of label fix ups
+* Defines the label at the given position, patching every jump that
+* was waiting on it
+*/
+void add_label( uint32_t label_id, uint32_t pos, LexState state )
+{
+  Label* label = &state->labels.labels[label_id];
+  label->pos = pos;
+  
+  LabelFixup* fixup;
+  for( fixup = label->fixups; fixup != NULL; fixup = fixup->next )
+  {
+    MicroInstruction* minstr = &state->instructions[fixup->instr_offset];
+    minstr_set( minstr, state->geom.next_addr, pos );
+    state->labels.unresolved--;
+  }
+  label->fixups = NULL;
+}
+
+/**
+* Returns either the address associated with the given label,
+* or -1 if the label has not been defined
 */
-void fixup_label( char* label, uint8_t minstr_offset, LexState state )
+int find_label( uint32_t label, LexState state )
 {
-  LabelFixup* fixup = malloc( sizeof(Label) );
-  strncpy( fixup->label, label, strlen(label) );
+  return state->labels.labels[label].pos;
+}
+
+/**
+* Add the given instruction to the label's list of fix ups
+*/
+void fixup_label( uint32_t label_id, uint32_t minstr_offset, LexState state )
+{
+  Label* label = &state->labels.labels[label_id];
+  LabelFixup* fixup = arena_alloc( &state->arena, sizeof(LabelFixup) );
+  if( fixup == NULL )
+  {
+    error( "Out of memory", state );
+  }
   fixup->instr_offset = minstr_offset;
   
-  // make the new label the root of the state.labels linked list
-  fixup->next = state->fixups;
-  state->fixups = fixup;
+  // make the new fixup the root of the label's fix up list
+  fixup->next = label->fixups;
+  label->fixups = fixup;
+  state->labels.unresolved++;
+}
+
+void reset_labels( LexState state )
+{
+  arena_reset( &state->arena );
+  memset( &state->labels, 0, sizeof(LabelTable) );
+}
+
+bool init_geometry( RomGeometry* geom, uint32_t depth, int word_bits, int addr_bits )
+{
+  if( depth == 0 )
+  {
+    return false;
+  }
+  
+  if( addr_bits == 0 )
+  {
+    addr_bits = NEXT_ADDR_BITS;
+    while( addr_bits < 32 && ((uint64_t)1 << addr_bits) < depth )
+    {
+      addr_bits++;
+    }
+  }
+  
+  // MODE, two spare bits, CND, NXT_ADDR, four spare bits
+  int min_word_bits = 1 + 2 + 3 + addr_bits + 4;
+  if( min_word_bits < MINSTR_BITS )
+  {
+    min_word_bits = MINSTR_BITS;
+  }
+  if( word_bits == 0 )
+  {
+    word_bits = min_word_bits;
+  }
+  
+  if( word_bits < min_word_bits || word_bits > 32
+      || ((uint64_t)1 << addr_bits) < depth )
+  {
+    return false;
+  }
+  
+  geom->depth = depth;
+  geom->word_bits = word_bits;
+  geom->word_bytes = (word_bits + 7) / 8;
+  geom->addr_bits = addr_bits;
+  geom->next_addr = (uint32_t)(((uint64_t)1 << addr_bits) - 1) << 4;
+  geom->cond = (uint32_t)0x7 << (4 + addr_bits);
+  geom->mode = (uint32_t)1 << (word_bits - 1);
+  return true;
+}
+
+void init_state( LexState state, const char* src, size_t len, const RomGeometry* geom )
+{
+  memset( state, 0, sizeof(struct LexState) );
+  state->src = src;
+  state->src_end = src + len;
+  state->cur = src;
+  state->geom = *geom;
+}
+
+void reuse_state( LexState state, const char* src, size_t len )
+{
+  reset_labels( state );
+  
+  memset( state->instructions, 0, state->rom_capacity * sizeof(MicroInstruction) );
+  memset( state->instr_src, 0, state->rom_capacity * sizeof(uint32_t) );
+  state->rom_used = 0;
+  state->instr_pos = 0;
+  state->org_count = 0;
+  state->ir_count = 0;
+  state->section_count = 0;
+  memset( state->opcode_labels, 0, sizeof(state->opcode_labels) );
+  
+  state->src = src;
+  state->src_end = src + len;
+  state->cur = src;
+  state->token_start = src;
+  state->instr_start = src;
+  state->on_error = NULL;
+}
+
+void free_state( LexState state )
+{
+  reset_labels( state );
+  arena_free( &state->arena );
+  free( state->instructions );
+  free( state->instr_src );
+  free( state->orgs );
+  free( state->ir );
+  free( state->sections );
+  free( state->profile_executed );
+  free( state->profile_taken );
+  state->instructions = NULL;
+  state->instr_src = NULL;
+  state->orgs = NULL;
+  state->ir = NULL;
+  state->sections = NULL;
+  state->profile_executed = NULL;
+  state->profile_taken = NULL;
+  state->profile_lines = 0;
+  state->ir_count = 0;
+  state->ir_capacity = 0;
+  state->section_count = 0;
+  state->section_capacity = 0;
+  state->org_count = 0;
+  state->org_capacity = 0;
+  state->rom_capacity = 0;
+  state->rom_used = 0;
+}
+
+/**
+* Makes sure the instruction storage covers the given address
+*/
+static void grow_rom( uint32_t addr, LexState state )
+{
+  uint32_t capacity = state->rom_capacity == 0 ? 256 : state->rom_capacity;
+  while( capacity <= addr )
+  {
+    capacity *= 2;
+  }
+  if( capacity > state->geom.depth )
+  {
+    capacity = state->geom.depth;
+  }
+  
+  // each array is kept as soon as it has grown, so that if the second
+  // cannot, both still hold at least rom_capacity words for free_state
+  // and reuse_state; the capacity only changes once both have grown
+  MicroInstruction* instructions = realloc( state->instructions,
+                                            capacity * sizeof(MicroInstruction) );
+  if( instructions == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  state->instructions = instructions;
+  
+  uint32_t* instr_src = realloc( state->instr_src, capacity * sizeof(uint32_t) );
+  if( instr_src == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  state->instr_src = instr_src;
+  
+  // unused words are zero
+  uint32_t added = capacity - state->rom_capacity;
+  memset( instructions + state->rom_capacity, 0, added * sizeof(MicroInstruction) );
+  memset( instr_src + state->rom_capacity, 0, added * sizeof(uint32_t) );
+  
+  state->rom_capacity = capacity;
 }
 
 
@@ -416,62 +837,231 @@ uint32_t minstr_get( MicroInstruction minstr, uint32_t field )
 
 void write_minstr( MicroInstruction minstr, LexState state )
 {
-  printf("write: 0x%X \n", minstr);
-  if( minstr_get( minstr, M_MODE ) == 0 )
-  {
-    printf(" mw:%X aa:%X mb:%X ba:%X mf:%X fs:%X da:%X rw:%X \n",
-            minstr_get( minstr, M_MW ),
-            minstr_get( minstr, M_AA ),
-            minstr_get( minstr, M_MB ),
-            minstr_get( minstr, M_BA ),
-            minstr_get( minstr, M_MF ),
-            minstr_get( minstr, M_FS ),
-            minstr_get( minstr, M_DA ),
-            minstr_get( minstr, M_RW ) );
-    
-    
-  }
-  else
+  if( state->instr_pos >= state->geom.depth )
   {
-    printf(" cond:%X next_addr:%X  \n",
-            minstr_get( minstr, M_COND ),
-            minstr_get( minstr, M_NEXT_ADDR ) );
+    error( "ROM storage exceeded", state );
+    return;
   }
   
-  if( state->instr_pos == ROM_SIZE - 1 )
+  if( state->instr_pos >= state->rom_capacity )
   {
-    error( "ROM storage exceeded", state );
-    return;
+    grow_rom( state->instr_pos, state );
   }
   
   state->instructions[state->instr_pos] = minstr;
+  state->instr_src[state->instr_pos] = state->instr_start - state->src + 1;
   state->instr_pos++;
+  
+  if( state->instr_pos > state->rom_used )
+  {
+    state->rom_used = state->instr_pos;
+  }
 }
 
 
-void fixup_labels( LexState state )
+/**
+* Starts a new section of instructions placed from origin
+*/
+static void begin_section( uint32_t origin, bool relocatable, uint32_t src_offset,
+                           LexState state )
 {
-  LabelFixup* fixup = state->fixups;
-  while( fixup != NULL )
+  if( state->section_count == state->section_capacity )
   {
-    int offset = find_label( fixup->label, state );
-    if( offset == -1 )
+    uint32_t capacity = state->section_capacity == 0 ? 16 : state->section_capacity * 2;
+    IrSection* sections = realloc( state->sections, capacity * sizeof(IrSection) );
+    if( sections == NULL )
     {
-      error( "Unknown label", state );
-      return;
+      error( "Out of memory", state );
     }
-    MicroInstruction* minstr = &state->instructions[fixup->instr_offset];
-    minstr_set( minstr, M_NEXT_ADDR, offset );
+    state->sections = sections;
+    state->section_capacity = capacity;
+  }
+  IrSection* section = &state->sections[state->section_count++];
+  section->origin = origin;
+  section->first = state->ir_count;
+  section->count = 0;
+  section->src_offset = src_offset;
+  section->relocatable = relocatable;
+}
+
+/**
+* Appends a parsed instruction to the current section.  label is the
+* label id + 1 of a jump's target, or 0.
+*/
+static void emit_instr( MicroInstruction minstr, uint32_t label, LexState state )
+{
+  if( state->section_count == 0 )
+  {
+    begin_section( 0, false, 0, state );
+  }
+  if( state->instr_pos >= state->geom.depth )
+  {
+    error( "ROM storage exceeded", state );
+  }
+  if( state->ir_count == state->ir_capacity )
+  {
+    uint32_t capacity = state->ir_capacity == 0 ? 256 : state->ir_capacity * 2;
+    IrInstr* ir = realloc( state->ir, capacity * sizeof(IrInstr) );
+    if( ir == NULL )
+    {
+      error( "Out of memory", state );
+    }
+    state->ir = ir;
+    state->ir_capacity = capacity;
+  }
+  
+  IrInstr* instr = &state->ir[state->ir_count++];
+  instr->word = minstr;
+  instr->label = label;
+  instr->src_offset = state->instr_start - state->src;
+  instr->end_offset = state->cur - state->src;
+  instr->flags = 0;
+  instr->executed = 0;
+  instr->taken = 0;
+  state->sections[state->section_count - 1].count++;
+  
+  // keep counting positions so overflowing the ROM is still reported
+  // where it happens
+  state->instr_pos++;
+}
+
+/**
+* Writes every live instruction into the ROM, section by section.  Each
+* label takes the address of the instruction it labels (or of the next
+* live one, if a pass removed it) before anything is written, so jumps
+* are complete when they are written and a later .org that overlaps an
+* earlier one simply replaces its words.
+*/
+static void place_instrs( LexState state )
+{
+  // address each instruction index resolves to, with one extra entry
+  // for labels at the very end of the source
+  uint32_t* addr_of = malloc( (state->ir_count + 1) * sizeof(uint32_t) );
+  if( addr_of == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  addr_of[state->ir_count] = 0;
+  
+  uint32_t s;
+  uint32_t i;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    uint32_t end = section->first + section->count;
+    uint32_t pos = section->origin;
+    for( i = section->first; i < end; i++ )
+    {
+      if( !(state->ir[i].flags & IR_DEAD) )
+      {
+        addr_of[i] = pos++;
+      }
+    }
+    
+    // removed instructions resolve to the next live one in the section
+    uint32_t next = pos;
+    for( i = end; i > section->first; i-- )
+    {
+      if( state->ir[i - 1].flags & IR_DEAD )
+      {
+        addr_of[i - 1] = next;
+      }
+      next = addr_of[i - 1];
+    }
+    if( s + 1 == state->section_count )
+    {
+      addr_of[state->ir_count] = pos;
+    }
+  }
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    uint32_t instr = state->labels.labels[id].instr;
+    if( instr != 0 )
+    {
+      add_label( id, addr_of[instr - 1], state );
+    }
+  }
+  
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    uint32_t end = section->first + section->count;
     
-    fixup = fixup->next;
+    state->instr_pos = section->origin;
+    for( i = section->first; i < end; i++ )
+    {
+      IrInstr* instr = &state->ir[i];
+      if( instr->flags & IR_DEAD )
+      {
+        continue;
+      }
+      
+      // errors while placing point at the instruction responsible
+      state->instr_start = state->src + instr->src_offset;
+      state->cur = state->src + instr->end_offset;
+      
+      MicroInstruction minstr = instr->word;
+      if( instr->label != 0 )
+      {
+        int target = find_label( instr->label - 1, state );
+        if( target == -1 )
+        {
+          // never defined, left for fixup_labels to report
+          fixup_label( instr->label - 1, state->instr_pos, state );
+        }
+        else
+        {
+          minstr_set( &minstr, state->geom.next_addr, target );
+        }
+      }
+      write_minstr( minstr, state );
+    }
   }
+  
+  free( addr_of );
+  state->cur = state->src_end;
 }
 
+/**
+* Jumps are patched as soon as their label is placed, so all that is
+* left at the end is to check nothing is still waiting on a label
+*/
+void fixup_labels( LexState state )
+{
+  if( state->labels.unresolved > 0 )
+  {
+    error( "Unknown label", state );
+  }
+}
+
+/**
+* Fills in the mapping ROM from the .opcode labels, which are placed by
+* now like any other; opcodes without one keep their fixed slot
+*/
+static void map_opcodes( LexState state )
+{
+  uint32_t op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    uint32_t slot = op << OPCODE_SLOT_BITS;
+    if( state->opcode_labels[op] != 0 )
+    {
+      state->opcode_map[op] = find_label( state->opcode_labels[op] - 1, state );
+    }
+    else
+    {
+      state->opcode_map[op] = slot < state->geom.depth ? slot : 0;
+    }
+  }
+}
 
 void parse_instruction( LexState state, Token instr )
 {
   MicroInstruction minstr;
   memset( &minstr, 0, sizeof(MicroInstruction) );
+  uint32_t target = 0;
   
   switch( instr.value )
   {
@@ -609,7 +1199,7 @@ void parse_instruction( LexState state, Token instr )
         case MN_OR:  minstr_set( &minstr, M_FS, F_OR ); break;
       }
       break;
-      
+    
     }
     
     // two-register operand instructions
@@ -639,7 +1229,7 @@ void parse_instruction( LexState state, Token instr )
         case MN_LSH: minstr_set( &minstr, M_FS, F_LSH ); break;
         case MN_SAR: minstr_set( &minstr, M_FS, F_SAR ); break;
       }
-    
+      
       break;
     }
     
@@ -648,34 +1238,29 @@ void parse_instruction( LexState state, Token instr )
       Token addr = read_token( state );
       if( addr.type == TT_ADDR || addr.type == TT_LABEL )
       {
-        minstr_set( &minstr, M_MODE, 1 );
-        minstr_set( &minstr, M_COND, instr.flags );
+        minstr_set( &minstr, state->geom.mode, 1 );
+        minstr_set( &minstr, state->geom.cond, instr.flags );
         
         if( addr.type == TT_LABEL )
         {
-          int label_offset = find_label( state->buf, state );
-          if( label_offset == -1 )
-          {
-            // we are referencing a label that either doesn't exist
-            // or hasn't been defined yet, so add it as a fixup
-            fixup_label( state->buf, state->instr_pos, state );
-          }
-          else
-          {
-            // the label has been defined, so set its associated address
-            minstr_set( &minstr, M_NEXT_ADDR, label_offset );
-          }
+          // the address is filled in once the label has been placed
+          target = intern_label( state->buf, state->buf_len,
+                                 state->buf_hash, state ) + 1;
         }
         else if( addr.type == TT_ADDR )
         {
-          minstr_set( &minstr, M_NEXT_ADDR, addr.value );
+          if( addr.value >= state->geom.depth )
+          {
+            error( "Jump address outside of ROM", state );
+          }
+          minstr_set( &minstr, state->geom.next_addr, addr.value );
         }
       }
       else
       {
         error( "Expected address or label for jump instruction", state );
       }
-    
+      
       break;
     }
     
@@ -683,7 +1268,29 @@ void parse_instruction( LexState state, Token instr )
       error( "Unimplemented instruction", state );
   }
   
-  write_minstr( minstr, state );
+  emit_instr( minstr, target, state );
+}
+
+/**
+* Records an entry point for the cycle report
+*/
+static void add_entry( uint32_t addr, uint32_t label, const char* dir_start, LexState state )
+{
+  if( state->org_count == state->org_capacity )
+  {
+    uint32_t capacity = state->org_capacity == 0 ? 16 : state->org_capacity * 2;
+    OrgEntry* orgs = realloc( state->orgs, capacity * sizeof(OrgEntry) );
+    if( orgs == NULL )
+    {
+      error( "Out of memory", state );
+    }
+    state->orgs = orgs;
+    state->org_capacity = capacity;
+  }
+  state->orgs[state->org_count].addr = addr;
+  state->orgs[state->org_count].label = label;
+  state->orgs[state->org_count].src_offset = dir_start - state->src;
+  state->org_count++;
 }
 
 void parse_directive( LexState state, Token dir )
@@ -692,17 +1299,75 @@ void parse_directive( LexState state, Token dir )
   {
     case DR_ORG:
     {
+      const char* dir_start = state->token_start;
       Token addr = read_token( state );
       if( addr.type != TT_ADDR )
       {
-        printf( "%d", addr.type );
         error( "Expected address", state );
       }
       
+      if( addr.value >= state->geom.depth )
+      {
+        error( "Origin outside of ROM", state );
+      }
+      
       // reposition offset into instruction stream to the requested position
       // 
       state->instr_pos = addr.value;
       
+      // and remember it as an entry point
+      add_entry( addr.value, 0, dir_start, state );
+      
+      begin_section( addr.value, false, dir_start - state->src, state );
+      
+      break;
+    }
+    
+    case DR_OPCODE:
+    {
+      const char* dir_start = state->token_start;
+      Token op = read_token( state );
+      if( op.type != TT_ADDR )
+      {
+        error( "Expected opcode", state );
+      }
+      if( op.value == 0 || op.value >= OPCODE_COUNT )
+      {
+        error( "Opcode outside of range", state );
+      }
+      if( state->opcode_labels[op.value] != 0 )
+      {
+        error( "Opcode already has a routine", state );
+      }
+      
+      // an internal label on the next instruction, placed like any other
+      char name[8];
+      int len = sprintf( name, ".op%X", op.value );
+      uint32_t hash = 2166136261u;
+      int i;
+      for( i = 0; i < len; i++ )
+      {
+        // same FNV-1a hash as read_symbol
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+      }
+      uint32_t label = intern_label( name, len, hash, state );
+      if( state->section_count == 0 )
+      {
+        begin_section( 0, false, 0, state );
+      }
+      state->labels.labels[label].instr = state->ir_count + 1;
+      state->opcode_labels[op.value] = label + 1;
+      
+      add_entry( 0, label + 1, dir_start, state );
+      break;
+    }
+    
+    case DR_SECTION:
+    {
+      // placed by layout_sections, so only its size counts until then
+      state->instr_pos = 0;
+      begin_section( 0, true, state->token_start - state->src, state );
+      
       break;
     }
     
@@ -717,6 +1382,7 @@ void parse_directive( LexState state, Token dir )
 void parse_microcode( LexState state )
 {
   bool labelled = false;
+  bool dispatched = false;
   
   Token token = read_token( state );
   while( token.type != TT_EOF )
@@ -730,21 +1396,39 @@ void parse_microcode( LexState state )
       }
       labelled = false;
     }
+    if( dispatched )
+    {
+      if( token.type != TT_INSTR && token.type != TT_LABEL_DEF )
+      {
+        error( "Instruction must follow .opcode", state );
+        return;
+      }
+      dispatched = false;
+    }
     
     if( token.type == TT_INSTR )
     {
+      state->instr_start = state->token_start;
       parse_instruction( state, token );
     }
     else if( token.type == TT_DIR )
     {
       parse_directive( state, token );
+      dispatched = token.value == DR_OPCODE;
     }
     else if( token.type == TT_LABEL_DEF )
     {
-      if( find_label( state->buf, state ) == -1 )
+      uint32_t label = intern_label( state->buf, state->buf_len,
+                                     state->buf_hash, state );
+      if( state->labels.labels[label].instr == 0 )
       {
-        // label hasn't been used before, create it
-        add_label( state->buf, state->instr_pos, state );
+        // label hasn't been defined before, bind it to the next
+        // instruction; it gets an address when that is placed
+        if( state->section_count == 0 )
+        {
+          begin_section( 0, false, 0, state );
+        }
+        state->labels.labels[label].instr = state->ir_count + 1;
         labelled = true;
       }
       else
@@ -753,70 +1437,122 @@ void parse_microcode( LexState state )
         return;
       }
     }
-
+    
     token = read_token( state );
   }
+  
+  // an .opcode with nothing after it would map to past the last word
+  if( dispatched )
+  {
+    error( "Instruction must follow .opcode", state );
+  }
 }
 
-bool is_big_endian(void)
+bool assemble( LexState state )
 {
-  union {
-      uint32_t i;
-      char c[4];
-  } bint = {0x01020304};
-
-  return bint.c[0] == 1; 
+  jmp_buf on_error;
+  state->on_error = &on_error;
+  
+  if( setjmp( on_error ) != 0 )
+  {
+    state->on_error = NULL;
+    return false;
+  }
+  
+  // parse the microcode, collecting the instruction stream in state
+  parse_microcode( state );
+  
+  if( state->optimize & OPT_PEEPHOLE )
+  {
+    optimize_peephole( state );
+  }
+  if( state->optimize & OPT_PROFILE )
+  {
+    optimize_profile( state );
+  }
+  if( state->optimize & OPT_JUMPS )
+  {
+    optimize_jumps( state );
+  }
+  if( (state->optimize & OPT_TAILS) && optimize_tails( state )
+      && (state->optimize & OPT_JUMPS) )
+  {
+    // copies left behind are unreachable now
+    optimize_jumps( state );
+  }
+  
+  layout_sections( state );
+  place_instrs( state );
+  fixup_labels( state );
+  map_opcodes( state );
+  
+  state->on_error = NULL;
+  return true;
 }
 
-void write_binary( FILE* out_file, LexState state )
+/**
+* Two uppercase hex digits for every byte value
+*/
+#define HEX_ROW( hi ) \
+  {hi,'0'}, {hi,'1'}, {hi,'2'}, {hi,'3'}, {hi,'4'}, {hi,'5'}, {hi,'6'}, {hi,'7'}, \
+  {hi,'8'}, {hi,'9'}, {hi,'A'}, {hi,'B'}, {hi,'C'}, {hi,'D'}, {hi,'E'}, {hi,'F'}
+
+static const char HEX_PAIRS[256][2] = {
+  HEX_ROW('0'), HEX_ROW('1'), HEX_ROW('2'), HEX_ROW('3'),
+  HEX_ROW('4'), HEX_ROW('5'), HEX_ROW('6'), HEX_ROW('7'),
+  HEX_ROW('8'), HEX_ROW('9'), HEX_ROW('A'), HEX_ROW('B'),
+  HEX_ROW('C'), HEX_ROW('D'), HEX_ROW('E'), HEX_ROW('F')
+};
+
+#undef HEX_ROW
+
+/**
+* Stores the instruction most significant byte first, regardless of
+* the byte order of the host
+*/
+static void pack_minstr( MicroInstruction minstr, int word_bytes, uint8_t* out )
 {
-  if( is_big_endian() )
+  int b;
+  for( b = word_bytes - 1; b >= 0; b-- )
   {
-    MicroInstruction* instr_ptr = state->instructions;
-    fwrite( instr_ptr, 3, ROM_SIZE, out_file );
-  }
-  else
-  {
-    uint8_t* instr_ptr = (uint8_t*)state->instructions;
-    int i;
-    for( i=0; i < ROM_SIZE; i++ )
-    {
-      if( i > 0 )
-      {
-        fprintf( out_file, " " );
-      }
-      instr_ptr += 2; // skip to last byte of instruction
-      fwrite( instr_ptr, 1, 1, out_file );
-      instr_ptr--;
-      fwrite( instr_ptr, 1, 1, out_file );
-      instr_ptr--;
-      fwrite( instr_ptr, 1, 1, out_file );
-      instr_ptr += 4; // skip to next instruction
-    }
+    out[b] = (uint8_t)minstr;
+    minstr >>= 8;
   }
 }
 
-void write_logisim_byte( FILE* out_file, uint8_t byte )
+/**
+* Only the words up to the highest address used are written; anything
+* after that is zero
+*/
+bool write_binary( FILE* out_file, LexState state )
 {
-  if( byte < 16 )
+  int word_bytes = state->geom.word_bytes;
+  uint32_t count = state->rom_used;
+  uint8_t* image = malloc( (size_t)count * word_bytes + 1 );
+  if( image == NULL )
   {
-    fprintf( out_file, "0%X", byte );
+    return false;
   }
-  else
+  
+  uint32_t i;
+  for( i=0; i < count; i++ )
   {
-    fprintf( out_file, "%X", byte );
+    pack_minstr( state->instructions[i], word_bytes, &image[i * word_bytes] );
   }
+  fwrite( image, word_bytes, count, out_file );
+  free( image );
+  return true;
 }
 
 /**
 * Write the output in logisim format.  From the Logisim Documentation:
-
+  
   The file format used for image files is quite simple; the intention is that a 
   user can write a program, such as an assembler, that generates memory images 
   that can then be loaded into the RAM. As an example of this file format, if 
   we had a 256-byte memory whose first five bytes were 2, 3, 0, 20, and -1, and 
   all subsequent values were 0, then the image would be the following text file.
-
+  
   v2.0 raw
   02
   03
@@ -829,111 +1565,155 @@ void write_logisim_byte( FILE* out_file, uint8_t byte )
   hexadecimal. Logisim will assume that any values unlisted in the file are 
   zero.
 */
-void write_logisim( FILE* out_file, LexState state )
+bool write_logisim( FILE* out_file, LexState state )
 {
-  fprintf( out_file, "v2.0 raw\x0A" );
+  static const char header[] = "v2.0 raw\x0A";
+  
+  int word_bytes = state->geom.word_bytes;
+  uint32_t count = state->rom_used;
   
-  if( is_big_endian() )
+  // header, then two hex digits per byte with a space between instructions
+  char* text = malloc( sizeof(header) + (size_t)count * (word_bytes * 2 + 1) );
+  if( text == NULL )
   {
-    uint8_t* instr_ptr = (uint8_t*)state->instructions;
-    int i;
-    for( i=0; i < ROM_SIZE; i++ )
-    {
-      if( i > 0 )
-      {
-        fprintf( out_file, " " );
-      }
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr++;
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr++;
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr+=2;
-    }
+    return false;
   }
-  else
+  char* out = text;
+  
+  memcpy( out, header, sizeof(header) - 1 );
+  out += sizeof(header) - 1;
+  
+  uint32_t i;
+  for( i=0; i < count; i++ )
   {
-    uint8_t* instr_ptr = (uint8_t*)state->instructions;
-    int i;
-    for( i=0; i < ROM_SIZE; i++ )
+    if( i > 0 )
     {
-      if( i > 0 )
-      {
-        fprintf( out_file, " " );
-      }
-      instr_ptr += 2; // skip to last byte of instruction
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr--;
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr--;
-      write_logisim_byte( out_file, *instr_ptr );
-      instr_ptr += 4; // skip to next instruction
+      *out++ = ' ';
     }
     
+    uint8_t bytes[sizeof(MicroInstruction)];
+    pack_minstr( state->instructions[i], word_bytes, bytes );
+    
+    int b;
+    for( b=0; b < word_bytes; b++ )
+    {
+      memcpy( out, HEX_PAIRS[bytes[b]], 2 );
+      out += 2;
+    }
   }
+  
+  fwrite( text, 1, out - text, out_file );
+  free( text );
+  return true;
 }
 
-int main( int argc, const char* argv[] )
+void write_opcode_map( FILE* out_file, bool binary, LexState state )
 {
-  FILE* src_file = NULL;
-  FILE* out_file = NULL;
-  bool binary_output = false;
-  int arg_pos = 1;
-  
-  if( arg_pos < argc )
+  // entries are addresses, in as many bytes as the NXT_ADDR field needs
+  int entry_bytes = (state->geom.addr_bits + 7) / 8;
+  if( !binary )
   {
-    if( strcmp( "-r", argv[arg_pos] ) == 0 )
-    {
-      binary_output = true;
-      arg_pos++;
-    }
+    fputs( "v2.0 raw\x0A", out_file );
   }
   
-  if( arg_pos < argc )
+  uint32_t op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
   {
-    src_file = fopen(argv[arg_pos], "r");
-    arg_pos++;
+    uint8_t bytes[sizeof(MicroInstruction)];
+    pack_minstr( state->opcode_map[op], entry_bytes, bytes );
+    if( binary )
+    {
+      fwrite( bytes, 1, entry_bytes, out_file );
+      continue;
+    }
+    
+    if( op > 0 )
+    {
+      fputc( ' ', out_file );
+    }
+    int b;
+    for( b=0; b < entry_bytes; b++ )
+    {
+      fwrite( HEX_PAIRS[bytes[b]], 1, 2, out_file );
+    }
   }
+}
+
+void write_listing( FILE* out_file, LexState state, const uint64_t* counts )
+{
+  // the listing can be large, so give it a generous buffer
+  setvbuf( out_file, NULL, _IOFBF, 1 << 16 );
   
-  if( arg_pos < argc )
-  {
-    out_file = fopen( argv[arg_pos], "wb" );
-  }
+  // index the start of every line once, so each instruction's line
+  // number is a binary search rather than a rescan of the source
+  uint32_t line_count;
+  uint32_t* starts = line_starts( state, &line_count );
   
-  if( out_file == NULL )
-  {
-    out_file =  stdout;
-  }
+  // hex digits for an address and for a word, and the column widths
+  int addr_digits = (state->geom.addr_bits + 3) / 4;
+  int word_digits = state->geom.word_bytes * 2;
+  int addr_width = addr_digits > 4 ? addr_digits : 4;
+  int word_width = word_digits > 4 ? word_digits : 4;
   
-  if( src_file == NULL )
+  if( counts != NULL )
   {
-    printf("Expected dda srcfile [outfile]\n");
-    return 1;
+    fprintf( out_file, "%10s ", "runs" );
   }
+  fprintf( out_file, "%-*s %-*s  %-40s %4s %s\n",
+           addr_width, "addr", word_width, "word", "fields", "line", "source" );
   
-  LexState state = &(struct LexState){ src_file, 1, 1, 0, 0 };
-  memset( &state->instructions, 0, ROM_SIZE );
-  
-  // parse the microcode, collecting the instruction stream in state
-  parse_microcode( state );
-  
-  fixup_labels( state );
-  
-  // write the instructions (in the correct byte order)
-  // to the file
-  if( binary_output )
+  uint32_t addr;
+  for( addr = 0; addr < state->rom_used; addr++ )
   {
-    write_binary( out_file, state );
-  }
-  else
-  {
-    write_logisim( out_file, state );
+    if( state->instr_src[addr] == 0 )
+    {
+      continue;
+    }
+    uint32_t offset = state->instr_src[addr] - 1;
+    MicroInstruction minstr = state->instructions[addr];
+    
+    char fields[64];
+    if( minstr_get( minstr, state->geom.mode ) == 0 )
+    {
+      sprintf( fields, "mw:%X aa:%X mb:%X ba:%X mf:%X fs:%X da:%X rw:%X",
+              minstr_get( minstr, M_MW ),
+              minstr_get( minstr, M_AA ),
+              minstr_get( minstr, M_MB ),
+              minstr_get( minstr, M_BA ),
+              minstr_get( minstr, M_MF ),
+              minstr_get( minstr, M_FS ),
+              minstr_get( minstr, M_DA ),
+              minstr_get( minstr, M_RW ) );
+    }
+    else
+    {
+      sprintf( fields, "cond:%X next_addr:%0*X",
+              minstr_get( minstr, state->geom.cond ),
+              addr_digits, minstr_get( minstr, state->geom.next_addr ) );
+    }
+    
+    uint32_t line = source_line( starts, line_count, offset );
+    const char* text = state->src + starts[line - 1];
+    const char* text_end = text;
+    while( text_end < state->src_end && *text_end != '\n' && *text_end != '\r' )
+    {
+      text_end++;
+    }
+    
+    // words that never ran stand out, as in gcov
+    if( counts != NULL && counts[addr] == 0 )
+    {
+      fprintf( out_file, "%10s ", "#####" );
+    }
+    else if( counts != NULL )
+    {
+      fprintf( out_file, "%10llu ", (unsigned long long)counts[addr] );
+    }
+    fprintf( out_file, "%*s%0*X %*s%0*X  %-40s %4d %.*s\n",
+             addr_width - addr_digits, "", addr_digits, addr,
+             word_width - word_digits, "", word_digits, minstr, fields,
+             (int)line, (int)(text_end - text), text );
   }
   
-  fclose( out_file );
-  
-  fclose( src_file );
-  
-
-  return 0;
-}
\ No newline at end of file
+  free( starts );
+}
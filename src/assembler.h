@@ -8,6 +8,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <setjmp.h>
 
 typedef struct
 {
@@ -36,81 +37,321 @@ static const Token TOKEN_EOF = { TT_EOF, 0 };
 
 #define BUF_SIZE 50
 
+/**
+* Default control store geometry.  Each can be overridden at build time
+* (-DROM_SIZE=4096 ...) or per run from the command line.
+*/
+#ifndef ROM_SIZE
 #define ROM_SIZE 256
+#endif
 
-#define MINSTR_BYTE_SIZE 3
+#ifndef MINSTR_BITS
+#define MINSTR_BITS 18
+#endif
 
+#ifndef NEXT_ADDR_BITS
+#define NEXT_ADDR_BITS 8
+#endif
 
-typedef struct Label
+#define MINSTR_BYTE_SIZE ((MINSTR_BITS + 7) / 8)
+
+/**
+* Shape of the control store.
+*
+* The micro operation fields are fixed, but the microsequencing fields
+* move with the width of NXT_ADDR: it always starts at bit 4, CND sits
+* directly above it and MODE is the top bit of the word.
+*/
+typedef struct RomGeometry
 {
-  char label[BUF_SIZE];
-  uint8_t pos;
+  uint32_t depth;           // number of words in the control store
+  uint8_t word_bits;        // width of a micro instruction
+  uint8_t word_bytes;       // bytes per micro instruction in an image
+  uint8_t addr_bits;        // width of the NXT_ADDR field
   
-  struct Label* next; // next label
+  uint32_t mode;            // M_MODE for this geometry
+  uint32_t cond;            // M_COND for this geometry
+  uint32_t next_addr;       // M_NEXT_ADDR for this geometry
 }
-Label;
+RomGeometry;
+
+/**
+* Fills in the geometry for the given depth and widths.  A width of 0 is
+* derived: addr_bits from the depth, word_bits from addr_bits.
+* Returns false if the fields do not fit.
+*/
+bool init_geometry( RomGeometry* geom, uint32_t depth, int word_bits, int addr_bits );
+
+
+/**
+* Bump allocator for the label table and fix ups.
+*
+* Everything allocated from an arena is released at once by arena_reset,
+* which keeps the blocks around so the next assembly can reuse them.
+*/
+typedef struct ArenaBlock
+{
+  struct ArenaBlock* next;
+  size_t size;
+  size_t used;
+  char data[];
+}
+ArenaBlock;
+
+typedef struct Arena
+{
+  ArenaBlock* head;
+  ArenaBlock* current;      // block allocations are currently served from
+}
+Arena;
+
+/**
+* Returns NULL if the arena could not grow
+*/
+void* arena_alloc( Arena* arena, size_t size );
+
+/**
+* Releases everything allocated from the arena, keeping its blocks
+*/
+void arena_reset( Arena* arena );
+
+/**
+* Returns the arena's blocks to the heap
+*/
+void arena_free( Arena* arena );
 
 typedef struct LabelFixup
 {
-  char label[BUF_SIZE];
-  uint8_t instr_offset;     // the offset of the MODE=1 instruction waiting on
+  uint32_t instr_offset;    // the offset of the MODE=1 instruction waiting on
                             // the address for its NXT_ADDR field
   struct LabelFixup* next;
 }
 LabelFixup;
 
+typedef struct Label
+{
+  uint32_t hash;            // hash of the name, computed once by the lexer
+  uint32_t name;            // offset of the interned name in LabelTable.names
+  int pos;                  // address of the label, or -1 until placed
+  uint32_t instr;           // index + 1 of the instruction it labels in
+                            // LexState.ir, 0 until defined
+  
+  LabelFixup* fixups;       // jumps waiting on this label to be defined
+}
+Label;
+
+/**
+* Open addressing hash table of labels.
+*
+* Labels live in a dense array and are referred to by their index (the
+* label id); the slot array maps hashes to ids using linear probing.
+* Names are interned once into a shared character pool.  All of it is
+* allocated from LexState.arena.
+*/
+typedef struct LabelTable
+{
+  Label* labels;
+  uint32_t count;
+  uint32_t capacity;        // allocated length of labels
+  
+  uint32_t* slots;          // label id + 1, or 0 for an empty slot
+  uint32_t slot_mask;       // slot count - 1, slot count is a power of two
+  
+  char* names;
+  uint32_t names_len;
+  uint32_t names_capacity;
+  
+  uint32_t unresolved;      // number of fix ups still waiting on a label
+}
+LabelTable;
+
+/**
+* A parsed instruction.  Instructions are collected in source order and
+* only placed in the ROM once the whole source has been read, so passes
+* can rewrite the stream first.
+*/
+typedef struct IrInstr
+{
+  MicroInstruction word;
+  uint32_t label;           // label id + 1 a jump goes to, 0 if none
+  uint32_t src_offset;      // start of the instruction in the source
+  uint32_t end_offset;      // read position after it, where errors point
+  uint32_t flags;           // IR_*
+  
+  uint64_t executed;        // times it ran in the profile (OPT_PROFILE)
+  uint64_t taken;           // times a jump was taken in the profile
+}
+IrInstr;
+
+#define IR_DEAD   0x1       // removed by a pass, not placed
+#define IR_PLACED 0x2       // starts a block the profile pass has placed
+
+/**
+* A run of instructions placed one after another from an origin, either
+* the start of the source, a .org or, for a .section, wherever the
+* layout finds room
+*/
+typedef struct IrSection
+{
+  uint32_t origin;          // set by layout_sections if relocatable
+  uint32_t first;           // index of its first instruction in LexState.ir
+  uint32_t count;
+  uint32_t src_offset;      // of the .org or .section, 0 if there is none
+  bool relocatable;         // started by .section
+}
+IrSection;
+
+// optional passes over the instruction stream, see LexState.optimize
+#define OPT_PEEPHOLE 0x1
+#define OPT_JUMPS    0x2
+#define OPT_TAILS    0x4
+#define OPT_SIZE     0x8    // trade cycles for words where the passes can
+#define OPT_PROFILE  0x10   // lay out hot paths from LexState.profile_*
+
+/**
+* A .org or .opcode directive, where the routine for an entry point starts
+*/
+typedef struct OrgEntry
+{
+  uint32_t addr;            // of a .org
+  uint32_t label;           // label id + 1 of an .opcode, whose address
+                            // is only known once placed
+  uint32_t src_offset;      // of the directive
+}
+OrgEntry;
+
+/**
+* Macro opcodes, and the log2 of the words per slot that each dispatches
+* to when there is no mapping ROM (OP << OPCODE_SLOT_BITS)
+*/
+#define OPCODE_COUNT     16
+#define OPCODE_SLOT_BITS 4
+
 typedef struct LexState
 {
-  FILE* in;
-  int line;
-  int column;
+  /** the whole source file, read into memory up front */
+  const char* src;
+  const char* src_end;
+  const char* cur;      // read position within src
+  const char* token_start;  // start of the last token read
+  const char* instr_start;  // start of the instruction being parsed
+  
   int buf_len;
-  uint8_t instr_pos;
+  uint32_t buf_hash;    // hash of the symbol in buf
+  uint64_t buf_key;     // packed bytes of the symbol in buf, 0 if too long
+  uint32_t instr_pos;
   
   char buf[BUF_SIZE];
+  
+  RomGeometry geom;
 
-  /** the memory layout of instructions */
-  MicroInstruction instructions[ROM_SIZE];
+  /** the memory layout of instructions, grown as addresses are used */
+  MicroInstruction* instructions;
   
-  Label* labels;
-  LabelFixup* fixups;
+  /** source offset + 1 of the instruction at each address, 0 if unused */
+  uint32_t* instr_src;
+  
+  uint32_t rom_capacity;    // allocated length of instructions and instr_src
+  uint32_t rom_used;        // one past the highest address written
+  
+  /** the parsed instruction stream */
+  IrInstr* ir;
+  uint32_t ir_count;
+  uint32_t ir_capacity;
+  
+  IrSection* sections;
+  uint32_t section_count;
+  uint32_t section_capacity;
+  
+  /** OPT_* passes to run before placement, set after init_state */
+  int optimize;
+  
+  /** label of the idle word, after which the next macro instruction is
+  *   dispatched; passes leave its section alone.  NULL means "idle". */
+  const char* fetch_label;
+  
+  /** times the words of each source line ran and jumped in a profile
+  *   read by read_profile, indexed by line; NULL without one */
+  uint64_t* profile_executed;
+  uint64_t* profile_taken;
+  uint32_t profile_lines;
+  
+  /** label id + 1 of the routine given by .opcode for each opcode */
+  uint32_t opcode_labels[OPCODE_COUNT];
+  
+  /** entry address of each opcode once assembled: its .opcode routine,
+  *   or its fixed slot if it has none.  The mapping ROM holds this. */
+  uint32_t opcode_map[OPCODE_COUNT];
+  
+  /** every .org and .opcode in source order */
+  OrgEntry* orgs;
+  uint32_t org_count;
+  uint32_t org_capacity;
+  
+  /** where error() jumps to, if NULL it prints the error and exits */
+  jmp_buf* on_error;
+  
+  char error_msg[128];
+  int error_line;
+  int error_column;
+  
+  LabelTable labels;
+  Arena arena;
 }
 *LexState;
 
-void add_label( char* label, uint8_t pos, LexState state );
+/**
+* Returns the id of the label with the given name and hash, adding
+* an undefined label the first time a name is seen
+*/
+uint32_t intern_label( const char* name, int len, uint32_t hash, LexState state );
+
+/**
+* Defines the label at the given position, patching every jump that
+* was waiting on it
+*/
+void add_label( uint32_t label, uint32_t pos, LexState state );
+
+/**
+* Returns the address of the label with the given (lowercase) name,
+* or -1 if there is no such label.  Does not add the name.
+*/
+int lookup_label( const char* name, LexState state );
 
 /**
 * Returns either the address associated with the given label,
-* or -1 if the label was not found
+* or -1 if the label has not been defined
 */
-int find_label( char* label, LexState state );
+int find_label( uint32_t label, LexState state );
 
 /**
-* Add the given instruction to the list of label fix ups
+* Add the given instruction to the label's list of fix ups
 */
-void fixup_label( char* label, uint8_t instr_offset, LexState state );
+void fixup_label( uint32_t label, uint32_t instr_offset, LexState state );
 
+/**
+* Releases the label table and all fix ups in one arena reset
+*/
+void reset_labels( LexState state );
 
+/**
+* Prepares the state to assemble the given source into a control store
+* of the given geometry
+*/
+void init_state( LexState state, const char* src, size_t len, const RomGeometry* geom );
+
+/**
+* Prepares a state that has already been used to assemble the given
+* source, keeping its instruction storage and arena
+*/
+void reuse_state( LexState state, const char* src, size_t len );
+
+/**
+* Releases everything owned by the state (but not the source)
+*/
+void free_state( LexState state );
 
-static const int MNEMONIC_COUNT = 0xe;
 
-static const char* MNEMONICS[] = {
-  "mov",
-  "add",
-  "sub",
-  "mul",
-  "rsh",
-  "not",
-  "and",
-  "div",
-  "or",
-  "nadd",
-  "lsh",
-  "sar",
-  "jmp",
-  "nop",
-  ".org"
-};
 
 // Mnemonics
 
@@ -130,7 +371,9 @@ static const char* MNEMONICS[] = {
 #define MN_NOP    0xd
 
 // Directives
-#define DR_ORG    0xe
+#define DR_ORG     0xe
+#define DR_SECTION 0xf
+#define DR_OPCODE  0x10
 
 
 #define CONST_0  0x0
@@ -143,6 +386,52 @@ static const char* MNEMONICS[] = {
 #define COND_Z 0x2
 #define COND_N 0x1
 
+/**
+* Reserved words are recognised by packing the lowercase bytes of a
+* symbol (up to 8) into an integer, byte 0 lowest, and switching on it.
+*/
+#define KEY1(a)           ((uint64_t)(a))
+#define KEY2(a,b)         (KEY1(a) | (uint64_t)(b) << 8)
+#define KEY3(a,b,c)       (KEY2(a,b) | (uint64_t)(c) << 16)
+#define KEY4(a,b,c,d)     (KEY3(a,b,c) | (uint64_t)(d) << 24)
+#define KEY5(a,b,c,d,e)   (KEY4(a,b,c,d) | (uint64_t)(e) << 32)
+#define KEY6(a,b,c,d,e,f) (KEY5(a,b,c,d,e) | (uint64_t)(f) << 40)
+#define KEY7(a,b,c,d,e,f,g)   (KEY6(a,b,c,d,e,f) | (uint64_t)(g) << 48)
+#define KEY8(a,b,c,d,e,f,g,h) (KEY7(a,b,c,d,e,f,g) | (uint64_t)(h) << 56)
+
+/**
+* Every reserved word as ( name, key, token type, value, flags ).
+* New mnemonics and directives only need an entry here.
+*/
+#define KEYWORDS( X ) \
+  X( "mov",    KEY3('m','o','v'),             TT_INSTR, MN_MOV,  0 ) \
+  X( "add",    KEY3('a','d','d'),             TT_INSTR, MN_ADD,  0 ) \
+  X( "sub",    KEY3('s','u','b'),             TT_INSTR, MN_SUB,  0 ) \
+  X( "mul",    KEY3('m','u','l'),             TT_INSTR, MN_MUL,  0 ) \
+  X( "rsh",    KEY3('r','s','h'),             TT_INSTR, MN_RSH,  0 ) \
+  X( "not",    KEY3('n','o','t'),             TT_INSTR, MN_NOT,  0 ) \
+  X( "and",    KEY3('a','n','d'),             TT_INSTR, MN_AND,  0 ) \
+  X( "div",    KEY3('d','i','v'),             TT_INSTR, MN_DIV,  0 ) \
+  X( "or",     KEY2('o','r'),                 TT_INSTR, MN_OR,   0 ) \
+  X( "nadd",   KEY4('n','a','d','d'),         TT_INSTR, MN_NADD, 0 ) \
+  X( "lsh",    KEY3('l','s','h'),             TT_INSTR, MN_LSH,  0 ) \
+  X( "sar",    KEY3('s','a','r'),             TT_INSTR, MN_SAR,  0 ) \
+  X( "nop",    KEY3('n','o','p'),             TT_INSTR, MN_NOP,  0 ) \
+  X( "jmp",    KEY3('j','m','p'),             TT_INSTR, MN_JMP,  0 ) \
+  X( "jmpp",   KEY4('j','m','p','p'),         TT_INSTR, MN_JMP,  COND_P ) \
+  X( "jmpz",   KEY4('j','m','p','z'),         TT_INSTR, MN_JMP,  COND_Z ) \
+  X( "jmpn",   KEY4('j','m','p','n'),         TT_INSTR, MN_JMP,  COND_N ) \
+  X( "jmppz",  KEY5('j','m','p','p','z'),     TT_INSTR, MN_JMP,  COND_P | COND_Z ) \
+  X( "jmppn",  KEY5('j','m','p','p','n'),     TT_INSTR, MN_JMP,  COND_P | COND_N ) \
+  X( "jmpzn",  KEY5('j','m','p','z','n'),     TT_INSTR, MN_JMP,  COND_Z | COND_N ) \
+  X( "jmppzn", KEY6('j','m','p','p','z','n'), TT_INSTR, MN_JMP,  COND_P | COND_Z | COND_N ) \
+  X( "a",      KEY1('a'),                     TT_CONST, CONST_A, 0 ) \
+  X( "b",      KEY1('b'),                     TT_CONST, CONST_B, 0 ) \
+  X( "c",      KEY1('c'),                     TT_CONST, CONST_C, 0 ) \
+  X( ".org",   KEY4('.','o','r','g'),         TT_DIR,   DR_ORG,  0 ) \
+  X( ".section", KEY8('.','s','e','c','t','i','o','n'), TT_DIR, DR_SECTION, 0 ) \
+  X( ".opcode", KEY7('.','o','p','c','o','d','e'), TT_DIR, DR_OPCODE, 0 )
+
 
 /**
 
@@ -230,6 +519,9 @@ const = { 0, 1, b0101, x4e }
 */
 
 // micro instruction masks
+//
+// M_MODE, M_COND and M_NEXT_ADDR are for the default geometry, anything
+// that may see a different control store uses RomGeometry instead
 #define M_MODE 0x20000
 
 // micro operation fields
@@ -264,17 +556,122 @@ const = { 0, 1, b0101, x4e }
 #define F_SAR      0xe
 #define F_MOV      0xf
 
+/**
+* Sets the given field (one of the M_* masks) of a micro instruction
+*/
+void minstr_set( MicroInstruction* minstr, uint32_t field, uint32_t value );
+
+/**
+* Returns the value of the given field (one of the M_* masks)
+*/
+uint32_t minstr_get( MicroInstruction minstr, uint32_t field );
+
 /*********
  Tokenize
 **********/
 
+/**
+* Reads the whole of the given file into a single heap buffer.
+* Returns NULL if the file could not be read.
+*/
+char* load_source( FILE* in, size_t* len );
+
+/**
+* Computes the line and column of the current read position.
+* Only used when reporting errors, so it simply rescans the source.
+*/
+void source_position( LexState state, int* line, int* column );
+
+/**
+* Reports an error at the current read position.  The message and
+* position are recorded in the state; if the state has an on_error
+* handler this jumps to it, otherwise it prints the error and exits.
+*/
 void error( char* msg, LexState state );
 
-int read( LexState state );
+/**
+* Parses the source, runs the passes selected by state->optimize, then
+* places the instructions in the ROM and resolves their labels.
+* Returns false if there was an error, leaving the message and position
+* in the state.
+*/
+bool assemble( LexState state );
 
-void unread( int c, LexState state );
+/**
+* Peephole pass over the parsed instructions (optimize.c): removes
+* micro operations whose results are never used and folds repeated
+* loads, without changing memory, the registers at the end of a basic
+* block or the flags a jump sees
+*/
+void optimize_peephole( LexState state );
 
-int peek( LexState state );
+/**
+* Gives every .section an origin in the addresses the pinned sections
+* leave free (layout.c).  Only does anything if the source uses .section,
+* in which case pinned sections that overlap are an error.
+*/
+void layout_sections( LexState state );
+
+/**
+* Writes the origin, size and source line of every section followed by
+* how much of the control store is used
+*/
+void write_layout_report( FILE* out_file, LexState state );
+
+/**
+* Offsets of the start of every line of the source, for source_line.
+* Sets count to the number of lines; the caller frees the array.
+*/
+uint32_t* line_starts( LexState state, uint32_t* count );
+
+/**
+* The line (from 1) holding the given source offset
+*/
+uint32_t source_line( const uint32_t* starts, uint32_t count, uint32_t offset );
+
+/**
+* Writes a profile (profile.c): the source line of every address that ran,
+* how often it ran and, for jumps, how often it was taken
+*/
+void write_profile( FILE* out_file, LexState state,
+                    const uint64_t* executed, const uint64_t* taken );
+
+/**
+* Reads a profile written by write_profile into state->profile_*, adding
+* up the addresses on each line.  Returns false if it is malformed.
+*/
+bool read_profile( LexState state, const char* text, size_t len );
+
+/**
+* Writes a coverage report of a profiled run: the counts of every
+* assembled word and source line, including those that never ran, how
+* often each function unit code was used and the memory reads and writes
+*/
+void write_coverage( FILE* out_file, LexState state,
+                     const uint64_t* executed, const uint64_t* taken );
+
+/**
+* Jump pass over the parsed instructions (optimize.c): threads jumps to
+* unconditional jumps, lays blocks out so unconditional jumps can fall
+* through instead, and removes jumps that are no longer needed along
+* with words that can no longer be reached
+*/
+void optimize_jumps( LexState state );
+
+/**
+* Tail pass over the parsed instructions (optimize.c): shares runs of
+* words that end in the same unconditional jump.  Returns true if it
+* changed anything.
+*/
+bool optimize_tails( LexState state );
+
+/**
+* Profile guided layout (optimize.c): where a conditional jump is mostly
+* not taken and an unconditional jump follows, inverts its condition and
+* swaps their targets; and moves the block a hot unconditional jump goes
+* to behind it, sending whatever fell into it there by a jump instead
+*/
+void optimize_profile( LexState state );
 
 void expect( int expected, LexState state );
 
@@ -285,4 +682,30 @@ uint16_t read_hex( LexState state );
 
 Token read_token( LexState state );
 
-#endif
\ No newline at end of file
+/**
+* Writes the assembled instructions as a raw image, most significant
+* byte of each instruction first.  Returns false if there is not enough
+* memory; unlike error() this is safe outside of assemble.
+*/
+bool write_binary( FILE* out_file, LexState state );
+
+/**
+* Writes the assembled instructions as a Logisim "v2.0 raw" image.
+* Returns false if there is not enough memory.
+*/
+bool write_logisim( FILE* out_file, LexState state );
+
+/**
+* Writes the mapping ROM, the entry address of each opcode, as a raw
+* image (most significant byte first) or a Logisim image
+*/
+void write_opcode_map( FILE* out_file, bool binary, LexState state );
+
+/**
+* Writes a listing of every assembled address: the address, the final
+* instruction word, its decoded fields and the source line it came from.
+* With counts (one per address) each row starts with how often it ran.
+*/
+void write_listing( FILE* out_file, LexState state, const uint64_t* counts );
+
+#endif
\ No newline at end of file
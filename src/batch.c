@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+static char* copy_string( const char* str, size_t len )
+{
+  char* copy = malloc( len + 1 );
+  if( copy != NULL )
+  {
+    memcpy( copy, str, len );
+    copy[len] = 0;
+  }
+  return copy;
+}
+
+char* default_out_path( const char* src_path )
+{
+  size_t len = strlen( src_path );
+  
+  // strip the extension, but only from the file name itself
+  size_t stem = len;
+  size_t i;
+  for( i = len; i > 0; i-- )
+  {
+    char c = src_path[i - 1];
+    if( c == '/' || c == '\\' )
+    {
+      break;
+    }
+    if( c == '.' )
+    {
+      stem = i - 1;
+      break;
+    }
+  }
+  
+  char* out_path = malloc( stem + sizeof(".rom") );
+  if( out_path != NULL )
+  {
+    memcpy( out_path, src_path, stem );
+    memcpy( out_path + stem, ".rom", sizeof(".rom") );
+  }
+  return out_path;
+}
+
+BatchJob* read_manifest( const char* path, int* count )
+{
+  FILE* manifest_file = fopen( path, "r" );
+  if( manifest_file == NULL )
+  {
+    return NULL;
+  }
+  
+  size_t len = 0;
+  char* text = load_source( manifest_file, &len );
+  fclose( manifest_file );
+  if( text == NULL )
+  {
+    return NULL;
+  }
+  
+  int capacity = 64;
+  int jobs_len = 0;
+  BatchJob* jobs = malloc( capacity * sizeof(BatchJob) );
+  
+  const char* c = text;
+  const char* end = text + len;
+  while( jobs != NULL && c < end )
+  {
+    const char* line_end = memchr( c, '\n', end - c );
+    if( line_end == NULL )
+    {
+      line_end = end;
+    }
+    
+    // split the line into at most two whitespace separated paths
+    const char* fields[2];
+    size_t field_lens[2];
+    int field_count = 0;
+    while( c < line_end && *c != ';' && field_count < 2 )
+    {
+      while( c < line_end && isspace( (unsigned char)*c ) )
+      {
+        c++;
+      }
+      const char* field = c;
+      while( c < line_end && !isspace( (unsigned char)*c ) )
+      {
+        c++;
+      }
+      if( c > field )
+      {
+        fields[field_count] = field;
+        field_lens[field_count] = c - field;
+        field_count++;
+      }
+    }
+    c = line_end + 1;
+    
+    if( field_count == 0 || fields[0][0] == ';' )
+    {
+      continue;
+    }
+    
+    if( jobs_len == capacity )
+    {
+      capacity *= 2;
+      BatchJob* grown = realloc( jobs, capacity * sizeof(BatchJob) );
+      if( grown == NULL )
+      {
+        free_jobs( jobs, jobs_len );
+        jobs = NULL;
+        break;
+      }
+      jobs = grown;
+    }
+    
+    BatchJob* job = &jobs[jobs_len++];
+    memset( job, 0, sizeof(BatchJob) );
+    job->src_path = copy_string( fields[0], field_lens[0] );
+    job->out_path = field_count > 1 ? copy_string( fields[1], field_lens[1] )
+                                    : default_out_path( job->src_path );
+  }
+  
+  free( text );
+  *count = jobs_len;
+  return jobs;
+}
+
+void free_jobs( BatchJob* jobs, int count )
+{
+  int i;
+  for( i = 0; i < count; i++ )
+  {
+    free( jobs[i].src_path );
+    free( jobs[i].out_path );
+  }
+  free( jobs );
+}
+
+int default_thread_count( void )
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  if( n > 0 )
+  {
+    return (int)n;
+  }
+#endif
+  return 4;
+}
+
+/**
+* Work shared between the worker threads; jobs are handed out in order
+*/
+typedef struct BatchQueue
+{
+  BatchJob* jobs;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+  
+  const RomGeometry* geom;
+  bool binary_output;
+  int optimize;
+  const char* fetch_label;
+}
+BatchQueue;
+
+static void run_job( BatchJob* job, BatchQueue* queue )
+{
+  FILE* src_file = fopen( job->src_path, "r" );
+  if( src_file == NULL )
+  {
+    sprintf( job->message, "Unable to open srcfile" );
+    return;
+  }
+  
+  size_t src_len = 0;
+  char* src = load_source( src_file, &src_len );
+  fclose( src_file );
+  if( src == NULL )
+  {
+    sprintf( job->message, "Unable to read srcfile" );
+    return;
+  }
+  
+  struct LexState lex_state;
+  LexState state = &lex_state;
+  init_state( state, src, src_len, queue->geom );
+  state->optimize = queue->optimize;
+  state->fetch_label = queue->fetch_label;
+  
+  if( !assemble( state ) )
+  {
+    snprintf( job->message, sizeof(job->message), "Error: %s @ line %d col %d",
+              state->error_msg, state->error_line, state->error_column );
+  }
+  else
+  {
+    FILE* out_file = fopen( job->out_path, "wb" );
+    if( out_file == NULL )
+    {
+      snprintf( job->message, sizeof(job->message),
+                "Unable to open outfile %s", job->out_path );
+    }
+    else
+    {
+      // a failed allocation fails this job only, there is no assemble
+      // to longjmp back to here
+      bool written = queue->binary_output ? write_binary( out_file, state )
+                                          : write_logisim( out_file, state );
+      job->ok = fclose( out_file ) == 0 && written;
+      if( !written )
+      {
+        snprintf( job->message, sizeof(job->message), "Out of memory" );
+      }
+      else if( !job->ok )
+      {
+        snprintf( job->message, sizeof(job->message),
+                  "Unable to write outfile %s", job->out_path );
+      }
+    }
+  }
+  
+  free_state( state );
+  free( src );
+}
+
+static void* batch_worker( void* arg )
+{
+  BatchQueue* queue = arg;
+  while( true )
+  {
+    pthread_mutex_lock( &queue->lock );
+    int job = queue->next;
+    if( job < queue->count )
+    {
+      queue->next++;
+    }
+    pthread_mutex_unlock( &queue->lock );
+    
+    if( job >= queue->count )
+    {
+      return NULL;
+    }
+    run_job( &queue->jobs[job], queue );
+  }
+}
+
+int run_batch( BatchJob* jobs, int count, int threads,
+               const RomGeometry* geom, bool binary_output,
+               int optimize, const char* fetch_label )
+{
+  BatchQueue queue = { jobs, count, 0 };
+  queue.geom = geom;
+  queue.binary_output = binary_output;
+  queue.optimize = optimize;
+  queue.fetch_label = fetch_label;
+  pthread_mutex_init( &queue.lock, NULL );
+  
+  if( threads > count )
+  {
+    threads = count;
+  }
+  if( threads < 1 )
+  {
+    threads = 1;
+  }
+  
+  // the calling thread is one of the workers
+  pthread_t* workers = malloc( threads * sizeof(pthread_t) );
+  int started = 0;
+  while( workers != NULL && started < threads - 1 )
+  {
+    if( pthread_create( &workers[started], NULL, batch_worker, &queue ) != 0 )
+    {
+      break;
+    }
+    started++;
+  }
+  
+  batch_worker( &queue );
+  
+  int i;
+  for( i = 0; i < started; i++ )
+  {
+    pthread_join( workers[i], NULL );
+  }
+  free( workers );
+  pthread_mutex_destroy( &queue.lock );
+  
+  int failed = 0;
+  for( i = 0; i < count; i++ )
+  {
+    if( !jobs[i].ok )
+    {
+      failed++;
+    }
+  }
+  return failed;
+}
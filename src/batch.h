@@ -0,0 +1,53 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "assembler.h"
+
+/**
+* One source file to assemble in batch mode
+*/
+typedef struct BatchJob
+{
+  char* src_path;
+  char* out_path;
+  
+  bool ok;
+  char message[256];        // the error, when not ok
+}
+BatchJob;
+
+/**
+* Returns the output path used for a source file when none is given:
+* the source path with its extension replaced by .rom
+*/
+char* default_out_path( const char* src_path );
+
+/**
+* Reads a manifest with one job per line, "srcfile [outfile]".
+* Blank lines and lines starting with ';' are skipped.
+* Returns NULL if the manifest could not be read.
+*/
+BatchJob* read_manifest( const char* path, int* count );
+
+/**
+* Releases the jobs and their paths
+*/
+void free_jobs( BatchJob* jobs, int count );
+
+/**
+* Returns the number of processors available, used as the default
+* number of worker threads
+*/
+int default_thread_count( void );
+
+/**
+* Assembles every job on a pool of worker threads, each job with its
+* own LexState.  A failing job records its error and does not affect the
+* others.  optimize and fetch_label are as in LexState.  Returns the
+* number of jobs that failed.
+*/
+int run_batch( BatchJob* jobs, int count, int threads,
+               const RomGeometry* geom, bool binary_output,
+               int optimize, const char* fetch_label );
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+#include "binfile.h"
+
+void put_u16( uint8_t* p, uint16_t v )
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+void put_u32( uint8_t* p, uint32_t v )
+{
+  put_u16( p, (uint16_t)v );
+  put_u16( p + 2, (uint16_t)(v >> 16) );
+}
+
+void put_u64( uint8_t* p, uint64_t v )
+{
+  put_u32( p, (uint32_t)v );
+  put_u32( p + 4, (uint32_t)(v >> 32) );
+}
+
+const uint8_t* map_file( const char* path, bool sequential, size_t* size )
+{
+#ifndef _WIN32
+  int fd = open( path, O_RDONLY );
+  if( fd < 0 )
+  {
+    return NULL;
+  }
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+  {
+    close( fd );
+    return NULL;
+  }
+  void* data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED )
+  {
+    return NULL;
+  }
+  
+  posix_madvise( data, st.st_size, sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_RANDOM );
+  *size = st.st_size;
+  return data;
+#else
+  (void)sequential;
+  HANDLE file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL );
+  if( file == INVALID_HANDLE_VALUE )
+  {
+    return NULL;
+  }
+  LARGE_INTEGER file_size;
+  HANDLE mapping = NULL;
+  if( GetFileSizeEx( file, &file_size ) && file_size.QuadPart > 0 )
+  {
+    mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+  }
+  CloseHandle( file );
+  if( mapping == NULL )
+  {
+    return NULL;
+  }
+  void* data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+  CloseHandle( mapping );
+  *size = (size_t)file_size.QuadPart;
+  return data;
+#endif
+}
+
+void unmap_file( const uint8_t* data, size_t size )
+{
+#ifndef _WIN32
+  munmap( (void*)data, size );
+#else
+  (void)size;
+  UnmapViewOfFile( data );
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef BINFILE_H
+#define BINFILE_H
+
+#include "assembler.h"
+
+/**
+* Binary files shared with other tools (traces and symbol tables)
+*
+* Fields are little endian whatever the host, written with the put_*
+* functions and read with the GET_* macros straight out of a mapping.
+*/
+
+#define GET_U16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define GET_U32(p) (GET_U16( p ) | ((uint32_t)GET_U16( (p) + 2 ) << 16))
+#define GET_U64(p) (GET_U32( p ) | ((uint64_t)GET_U32( (p) + 4 ) << 32))
+
+void put_u16( uint8_t* p, uint16_t v );
+void put_u32( uint8_t* p, uint32_t v );
+void put_u64( uint8_t* p, uint64_t v );
+
+/**
+* Maps the whole of the file at path read only, or returns NULL if it
+* cannot be read or is empty.  sequential hints that it will be read
+* front to back rather than searched.
+*/
+const uint8_t* map_file( const char* path, bool sequential, size_t* size );
+
+void unmap_file( const uint8_t* data, size_t size );
+
+#endif
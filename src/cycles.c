@@ -0,0 +1,281 @@
+#include "cycles.h"
+
+#define NO_PATH UINT32_MAX
+
+// depth first search colours
+#define WHITE 0
+#define GREY  1   // on the stack
+#define BLACK 2   // finished
+
+/**
+* The control store with the successors of each word worked out
+*/
+typedef struct CycleGraph
+{
+  uint32_t depth;
+  uint32_t fetch_addr;
+  uint32_t (*succ)[2];      // NO_PATH where there is no successor
+  
+  uint8_t* colour;
+  uint8_t* loops;           // a loop is reachable without passing idle
+  uint32_t* longest;        // words on the longest path to idle, or NO_PATH
+}
+CycleGraph;
+
+static void build_graph( CycleGraph* g, const MicroInstruction* rom, uint32_t rom_len,
+                         const RomGeometry* geom )
+{
+  uint32_t addr;
+  for( addr = 0; addr < g->depth; addr++ )
+  {
+    MicroInstruction w = addr < rom_len ? rom[addr] : 0;
+    uint32_t next = addr + 1 < g->depth ? addr + 1 : 0;
+    
+    g->succ[addr][0] = next;
+    g->succ[addr][1] = NO_PATH;
+    if( w & geom->mode )
+    {
+      uint32_t target = minstr_get( w, geom->next_addr );
+      target = target < g->depth ? target : 0;
+      if( minstr_get( w, geom->cond ) == 0 )
+      {
+        g->succ[addr][0] = target;
+      }
+      else
+      {
+        g->succ[addr][1] = target;
+      }
+    }
+  }
+}
+
+/**
+* Longest path to idle from every word reachable from root, without
+* recursion since routines can be as long as the ROM
+*/
+static void longest_paths( CycleGraph* g, uint32_t root, uint32_t* stack )
+{
+  if( g->colour[root] != WHITE || root == g->fetch_addr )
+  {
+    return;
+  }
+  
+  uint32_t top = 0;
+  stack[top++] = root;
+  g->colour[root] = GREY;
+  
+  while( top > 0 )
+  {
+    uint32_t v = stack[top - 1];
+    
+    // descend into the first unvisited successor
+    bool descended = false;
+    int i;
+    for( i = 0; i < 2 && !descended; i++ )
+    {
+      uint32_t s = g->succ[v][i];
+      if( s == NO_PATH || s == g->fetch_addr )
+      {
+        continue;
+      }
+      if( g->colour[s] == WHITE )
+      {
+        g->colour[s] = GREY;
+        stack[top++] = s;
+        descended = true;
+      }
+      else if( g->colour[s] == GREY )
+      {
+        g->loops[v] = 1;
+      }
+    }
+    if( descended )
+    {
+      continue;
+    }
+    
+    // every successor is finished, or is still on the stack and so
+    // closes a loop; those have no longest path yet and are left out
+    uint32_t longest = NO_PATH;
+    for( i = 0; i < 2; i++ )
+    {
+      uint32_t s = g->succ[v][i];
+      uint32_t len = NO_PATH;
+      if( s == g->fetch_addr )
+      {
+        len = 0;
+      }
+      else if( s != NO_PATH && g->colour[s] == BLACK )
+      {
+        g->loops[v] |= g->loops[s];
+        len = g->longest[s];
+      }
+      if( len != NO_PATH && (longest == NO_PATH || len > longest) )
+      {
+        longest = len;
+      }
+    }
+    g->longest[v] = longest == NO_PATH ? NO_PATH : longest + 1;
+    g->colour[v] = BLACK;
+    top--;
+  }
+}
+
+/**
+* Shortest path to idle from entry, breadth first
+*/
+static uint32_t shortest_path( const CycleGraph* g, uint32_t entry, uint32_t* queue,
+                               uint32_t* dist )
+{
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  uint32_t found = NO_PATH;
+  
+  memset( dist, 0xff, g->depth * sizeof(uint32_t) );
+  dist[entry] = 1;
+  queue[tail++] = entry;
+  
+  while( head < tail && found == NO_PATH )
+  {
+    uint32_t v = queue[head++];
+    int i;
+    for( i = 0; i < 2; i++ )
+    {
+      uint32_t s = g->succ[v][i];
+      if( s == NO_PATH )
+      {
+        continue;
+      }
+      if( s == g->fetch_addr )
+      {
+        found = dist[v];
+        break;
+      }
+      if( dist[s] == NO_PATH )
+      {
+        dist[s] = dist[v] + 1;
+        queue[tail++] = s;
+      }
+    }
+  }
+  return found;
+}
+
+bool cycle_bounds( const MicroInstruction* rom, uint32_t rom_len,
+                   const RomGeometry* geom, uint32_t fetch_addr,
+                   const uint32_t* entries, uint32_t count, CycleBounds* bounds )
+{
+  CycleGraph g;
+  g.depth = geom->depth;
+  g.fetch_addr = fetch_addr;
+  g.succ = malloc( g.depth * sizeof(*g.succ) );
+  g.colour = calloc( g.depth, 1 );
+  g.loops = calloc( g.depth, 1 );
+  g.longest = malloc( g.depth * sizeof(uint32_t) );
+  uint32_t* work = malloc( g.depth * sizeof(uint32_t) );
+  uint32_t* dist = malloc( g.depth * sizeof(uint32_t) );
+  
+  bool ok = g.succ != NULL && g.colour != NULL && g.loops != NULL
+            && g.longest != NULL && work != NULL && dist != NULL;
+  if( ok )
+  {
+    build_graph( &g, rom, rom_len, geom );
+    
+    uint32_t i;
+    for( i = 0; i < count; i++ )
+    {
+      CycleBounds* b = &bounds[i];
+      uint32_t entry = entries[i] < g.depth ? entries[i] : 0;
+      memset( b, 0, sizeof(CycleBounds) );
+      b->entry = entry;
+      if( entry == fetch_addr )
+      {
+        // the idle word goes straight back to itself
+        b->returns = true;
+        continue;
+      }
+      
+      longest_paths( &g, entry, work );
+      uint32_t min = shortest_path( &g, entry, work, dist );
+      b->returns = min != NO_PATH;
+      b->unbounded = g.loops[entry] != 0;
+      b->min = b->returns ? min : 0;
+      b->max = b->returns && !b->unbounded ? g.longest[entry] : 0;
+    }
+  }
+  
+  free( g.succ );
+  free( g.colour );
+  free( g.loops );
+  free( g.longest );
+  free( work );
+  free( dist );
+  return ok;
+}
+
+void write_cycle_report( FILE* out_file, LexState state, uint32_t fetch_addr )
+{
+  uint32_t count = state->org_count;
+  uint32_t* entries = calloc( count + 1, sizeof(uint32_t) );
+  CycleBounds* bounds = malloc( (count + 1) * sizeof(CycleBounds) );
+  if( entries == NULL || bounds == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  
+  uint32_t i;
+  for( i = 0; i < count; i++ )
+  {
+    const OrgEntry* org = &state->orgs[i];
+    entries[i] = org->label != 0 ? (uint32_t)find_label( org->label - 1, state ) : org->addr;
+  }
+  if( !cycle_bounds( state->instructions, state->rom_used, &state->geom, fetch_addr,
+                     entries, count, bounds ) )
+  {
+    error( "Out of memory", state );
+  }
+  
+  int addr_digits = (state->geom.addr_bits + 3) / 4;
+  int addr_width = addr_digits > 5 ? addr_digits : 5;
+  fprintf( out_file, "%-*s %5s %6s %6s  %s\n", addr_width, "entry", "line", "min", "max", "note" );
+  
+  // lines are counted incrementally, the entries are in source order
+  int line = 1;
+  const char* c = state->src;
+  for( i = 0; i < count; i++ )
+  {
+    const char* org = state->src + state->orgs[i].src_offset;
+    while( c < org )
+    {
+      line += *c++ == '\n';
+    }
+    
+    const CycleBounds* b = &bounds[i];
+    char min[16];
+    char max[16];
+    const char* note = "";
+    sprintf( min, "%u", b->min );
+    sprintf( max, "%u", b->max );
+    if( b->entry == fetch_addr )
+    {
+      note = "idle";
+    }
+    else if( !b->returns )
+    {
+      strcpy( min, "-" );
+      strcpy( max, "-" );
+      note = "never returns to idle";
+    }
+    else if( b->unbounded )
+    {
+      strcpy( max, "-" );
+      note = "unbounded loop";
+    }
+    fprintf( out_file, "%0*X%*s %5d %6s %6s", addr_digits, b->entry,
+             addr_width - addr_digits, "", line, min, max );
+    fprintf( out_file, note[0] != 0 ? "  %s\n" : "\n", note );
+  }
+  
+  free( entries );
+  free( bounds );
+}
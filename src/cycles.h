@@ -0,0 +1,39 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "assembler.h"
+
+/**
+* Static cycle counts per entry point
+*
+* Follows the control flow of the assembled ROM (fall through, NXT_ADDR
+* and CND) from an entry point until it jumps back to the idle word and
+* counts the microcycles on the shortest and the longest path.  The idle
+* word itself is not counted.
+*/
+
+typedef struct CycleBounds
+{
+  uint32_t entry;
+  uint32_t min;             // shortest path back to idle
+  uint32_t max;             // longest, when bounded
+  bool returns;             // some path gets back to idle
+  bool unbounded;           // a loop is reachable, so max is unknown
+}
+CycleBounds;
+
+/**
+* Computes the bounds for each of count entry points.  Returns false if
+* there is not enough memory.
+*/
+bool cycle_bounds( const MicroInstruction* rom, uint32_t rom_len,
+                   const RomGeometry* geom, uint32_t fetch_addr,
+                   const uint32_t* entries, uint32_t count, CycleBounds* bounds );
+
+/**
+* Writes a table of the bounds for every .org in the source, one line
+* per entry point in source order
+*/
+void write_cycle_report( FILE* out_file, LexState state, uint32_t fetch_addr );
+
+#endif
@@ -0,0 +1,86 @@
+#include "assembler.h"
+#include "dda.h"
+
+struct DdaContext
+{
+  struct LexState state;
+  bool used;                // state holds buffers from an earlier assembly
+  int optimize;             // OPT_* passes
+};
+
+DdaContext* dda_new( const DdaOptions* options )
+{
+  DdaOptions defaults = { ROM_SIZE, 0, 0, 0 };
+  if( options == NULL )
+  {
+    options = &defaults;
+  }
+  
+  RomGeometry geom;
+  uint32_t depth = options->depth != 0 ? options->depth : ROM_SIZE;
+  if( !init_geometry( &geom, depth, options->word_bits, options->addr_bits ) )
+  {
+    return NULL;
+  }
+  
+  DdaContext* ctx = malloc( sizeof(DdaContext) );
+  if( ctx == NULL )
+  {
+    return NULL;
+  }
+  init_state( &ctx->state, NULL, 0, &geom );
+  ctx->used = false;
+  ctx->optimize = options->optimize ? OPT_PEEPHOLE | OPT_JUMPS | OPT_TAILS : 0;
+  ctx->optimize |= options->optimize > 1 ? OPT_SIZE : 0;
+  return ctx;
+}
+
+void dda_free( DdaContext* ctx )
+{
+  if( ctx != NULL )
+  {
+    free_state( &ctx->state );
+    free( ctx );
+  }
+}
+
+DdaDiagnostic dda_assemble( DdaContext* ctx, const char* src, size_t len,
+                            uint32_t* words, size_t capacity )
+{
+  DdaDiagnostic diag;
+  memset( &diag, 0, sizeof(DdaDiagnostic) );
+  
+  LexState state = &ctx->state;
+  if( ctx->used )
+  {
+    reuse_state( state, src, len );
+  }
+  else
+  {
+    RomGeometry geom = state->geom;
+    init_state( state, src, len, &geom );
+    ctx->used = true;
+  }
+  state->optimize = ctx->optimize;
+  
+  if( !assemble( state ) )
+  {
+    snprintf( diag.message, sizeof(diag.message), "%s", state->error_msg );
+    diag.line = state->error_line;
+    diag.column = state->error_column;
+    return diag;
+  }
+  
+  diag.words_used = state->rom_used;
+  if( state->rom_used > capacity )
+  {
+    snprintf( diag.message, sizeof(diag.message),
+              "Output holds %u words, %u needed",
+              (unsigned)capacity, (unsigned)state->rom_used );
+    return diag;
+  }
+  
+  memcpy( words, state->instructions, state->rom_used * sizeof(uint32_t) );
+  diag.ok = 1;
+  return diag;
+}
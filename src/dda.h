@@ -0,0 +1,65 @@
+#ifndef DDA_H
+#define DDA_H
+
+/**
+* libdda: reentrant interface to the DDmini assembler.
+*
+* Assembles source held in memory into a caller provided array of
+* micro instructions.  Nothing is printed, the process is never exited
+* and there is no global state, so any number of contexts can be used
+* from different threads at once.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+* Control store geometry; any field left 0 takes its default
+* (256 words, NXT_ADDR wide enough for the depth, smallest word that fits)
+*/
+typedef struct DdaOptions
+{
+  uint32_t depth;
+  int word_bits;
+  int addr_bits;
+  
+  int optimize;             // 1 for the passes of dda -O, 2 for -Os, 0 for none
+}
+DdaOptions;
+
+/**
+* Result of an assembly
+*/
+typedef struct DdaDiagnostic
+{
+  int ok;                   // 1 on success, 0 if there was an error
+  char message[128];        // the error, when not ok
+  int line;                 // source position of the error, 0 if none
+  int column;
+  
+  uint32_t words_used;      // one past the highest address assembled
+}
+DdaDiagnostic;
+
+/**
+* Assembler context holding buffers reused between assemblies
+*/
+typedef struct DdaContext DdaContext;
+
+/**
+* Returns a new context, or NULL if the geometry does not fit or there is
+* no memory.  options may be NULL for the default geometry.
+*/
+DdaContext* dda_new( const DdaOptions* options );
+
+void dda_free( DdaContext* ctx );
+
+/**
+* Assembles len bytes of source into words.  On success the first
+* words_used entries of words hold the image (unused addresses are 0);
+* capacity is the length of words and must be at least words_used.
+*/
+DdaDiagnostic dda_assemble( DdaContext* ctx, const char* src, size_t len,
+                            uint32_t* words, size_t capacity );
+
+#endif
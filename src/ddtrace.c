@@ -0,0 +1,386 @@
+#include "trace.h"
+#include "binfile.h"
+#include "symbols.h"
+
+/*
+* ddtrace: reads traces written by dda --sim --trace, see trace.h
+*
+*   ddtrace info trace
+*   ddtrace dump [filters] trace
+*   ddtrace diff trace1 trace2
+*
+* With --symbols (a file from dda --symbols) every line is annotated with
+* the label and source line of its word, and --pc also takes a label.
+*
+* The trace is mapped, not loaded, so dumping a window of a long run
+* starts from the closest keyframe and diffing compares the records
+* directly until they first differ.
+*/
+
+// cycles before the first difference that diff shows
+#define DIFF_CONTEXT 4
+
+/**
+* Which steps dump prints
+*/
+typedef struct Filter
+{
+  uint64_t from;            // first cycle
+  uint64_t count;           // cycles after it
+  int64_t upc;              // only the word at this address, or -1
+  int reg;                  // only writes to this register, or -1
+  int64_t mem;              // only writes to this memory address, or -1
+  bool fetches;             // only macro instruction fetches
+}
+Filter;
+
+static int addr_digits( const TraceFile* trace )
+{
+  int digits = 2;
+  while( digits < 8 && (uint64_t)1 << (4 * digits) < trace->depth )
+  {
+    digits++;
+  }
+  return digits;
+}
+
+static char flag_name( uint8_t flags )
+{
+  return flags & COND_P ? 'P' : flags & COND_Z ? 'Z' : flags & COND_N ? 'N' : '-';
+}
+
+/**
+* Prints a step, followed by the label and source line of its word if
+* there is a symbol file
+*/
+static void print_step( const char* prefix, const TraceFile* trace, const SymFile* syms,
+                        const TraceStep* step )
+{
+  int digits = addr_digits( trace );
+  if( step->kind == TRACE_FETCH )
+  {
+    printf("%s%10llu %*s fetch %04X -> %0*X", prefix, (unsigned long long)step->cycle,
+           digits, "", step->ir, digits, step->upc);
+  }
+  else
+  {
+    printf("%s%10llu %0*X %c", prefix, (unsigned long long)step->cycle, digits, step->upc,
+           flag_name( step->flags ));
+  }
+  
+  if( step->kind == TRACE_JUMP && step->taken )
+  {
+    printf(" jump %0*X", digits, step->next);
+  }
+  else if( step->kind == TRACE_JUMP )
+  {
+    printf(" fall");
+  }
+  if( step->reg >= 0 )
+  {
+    printf(" r%d=%04X", step->reg, step->value);
+  }
+  if( step->store )
+  {
+    printf(" M[%04X]=%04X", step->mem_addr, step->mem_value);
+  }
+  
+  uint32_t offset;
+  const char* label = syms != NULL ? sym_label_before( syms, step->upc, &offset ) : NULL;
+  uint32_t line;
+  uint32_t column;
+  if( label != NULL && offset == 0 )
+  {
+    printf("  ; %s", label);
+  }
+  else if( label != NULL )
+  {
+    printf("  ; %s+%u", label, offset);
+  }
+  if( step->kind != TRACE_FETCH && syms != NULL
+      && sym_line_at( syms, step->upc, &line, &column ) )
+  {
+    printf("%s%s:%u", label != NULL ? " " : "  ; ", syms->source, line);
+  }
+  printf("\n");
+}
+
+static bool matches( const Filter* filter, const TraceStep* step )
+{
+  if( filter->fetches )
+  {
+    return step->kind == TRACE_FETCH;
+  }
+  if( filter->upc >= 0 && (step->kind == TRACE_FETCH || step->upc != filter->upc) )
+  {
+    return false;
+  }
+  if( filter->reg >= 0 && step->reg != filter->reg )
+  {
+    return false;
+  }
+  if( filter->mem >= 0 && (!step->store || step->mem_addr != filter->mem) )
+  {
+    return false;
+  }
+  return true;
+}
+
+static int info( const TraceFile* trace )
+{
+  printf("cycles: %llu\n", (unsigned long long)trace->cycles);
+  printf("records: %llu\n", (unsigned long long)trace->records);
+  printf("keyframes: %llu, every %u cycles\n", (unsigned long long)trace->keyframe_count,
+         trace->interval);
+  printf("depth: %u\n", trace->depth);
+  printf("bytes: %llu", (unsigned long long)trace->size);
+  if( trace->cycles > 0 )
+  {
+    printf(" (%.2f per cycle)", (double)trace->size / trace->cycles);
+  }
+  printf("\n");
+  
+  TraceState state;
+  trace_seek( trace, trace->cycles, &state );
+  printf("end: pc %u,", state.pc);
+  int r;
+  for( r = 0; r < SIM_REGS; r++ )
+  {
+    printf(" r%d=%04X", r, state.regs[r]);
+  }
+  printf("\n");
+  return 0;
+}
+
+static int dump( const TraceFile* trace, const SymFile* syms, const Filter* filter )
+{
+  TraceState state;
+  trace_seek( trace, filter->from, &state );
+  
+  TraceStep step;
+  while( trace_step( trace, &state, &step ) )
+  {
+    if( step.kind != TRACE_FETCH && step.cycle - filter->from >= filter->count )
+    {
+      break;
+    }
+    if( matches( filter, &step ) )
+    {
+      print_step( "", trace, syms, &step );
+    }
+  }
+  return 0;
+}
+
+static uint32_t record_at( const TraceFile* trace, uint64_t record )
+{
+  return GET_U32( trace->data + TRACE_HEADER_SIZE + record * 4 );
+}
+
+static int diff( const TraceFile* a, const TraceFile* b, const SymFile* syms )
+{
+  // the records are compared as they are, a chunk at a time
+  uint64_t common = a->records < b->records ? a->records : b->records;
+  const uint8_t* ra = a->data + TRACE_HEADER_SIZE;
+  const uint8_t* rb = b->data + TRACE_HEADER_SIZE;
+  uint64_t chunk = 1 << 18;
+  uint64_t k = 0;
+  while( k < common )
+  {
+    uint64_t n = common - k < chunk ? common - k : chunk;
+    if( memcmp( ra + k * 4, rb + k * 4, n * 4 ) != 0 )
+    {
+      while( record_at( a, k ) == record_at( b, k ) )
+      {
+        k++;
+      }
+      break;
+    }
+    k += n;
+  }
+  if( k == a->records && k == b->records )
+  {
+    printf("traces are the same, %llu cycles\n", (unsigned long long)a->cycles);
+    return 0;
+  }
+  
+  // both are the same up to record k, so replay them together from the
+  // same keyframe, keeping the last few steps for context
+  TraceState sa;
+  TraceState sb;
+  trace_seek_record( a, k, &sa );
+  trace_seek_record( b, k, &sb );
+  TraceStep context[DIFF_CONTEXT];
+  uint64_t seen = 0;
+  TraceStep step;
+  while( sa.record < k && trace_step( a, &sa, &step ) )
+  {
+    context[seen++ % DIFF_CONTEXT] = step;
+  }
+  while( sb.record < k && trace_step( b, &sb, &step ) )
+  {
+  }
+  
+  TraceStep step_a;
+  TraceStep step_b;
+  bool more_a = trace_step( a, &sa, &step_a );
+  bool more_b = trace_step( b, &sb, &step_b );
+  printf("first difference at cycle %llu\n",
+         (unsigned long long)(more_a ? step_a.cycle : step_b.cycle));
+  uint64_t i;
+  for( i = seen > DIFF_CONTEXT ? seen - DIFF_CONTEXT : 0; i < seen; i++ )
+  {
+    print_step( "  ", a, syms, &context[i % DIFF_CONTEXT] );
+  }
+  if( more_a )
+  {
+    print_step( "< ", a, syms, &step_a );
+  }
+  else
+  {
+    printf("< end of trace\n");
+  }
+  if( more_b )
+  {
+    print_step( "> ", b, syms, &step_b );
+  }
+  else
+  {
+    printf("> end of trace\n");
+  }
+  return 1;
+}
+
+static bool open_trace( TraceFile* trace, const char* path )
+{
+  const char* error;
+  if( !trace_open( trace, path, &error ) )
+  {
+    printf(error, path);
+    printf("\n");
+    return false;
+  }
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  if( argc < 3 )
+  {
+    printf("Expected ddtrace info trace, ddtrace dump [filters] trace or ddtrace diff trace1 trace2\n");
+    return 1;
+  }
+  const char* command = argv[1];
+  
+  Filter filter = { 0, UINT64_MAX, -1, -1, -1, false };
+  const char* pc = NULL;
+  const char* symbols_path = NULL;
+  int arg_pos = 2;
+  while( arg_pos < argc && argv[arg_pos][0] == '-' )
+  {
+    if( strcmp( "--from", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      filter.from = strtoull( argv[++arg_pos], NULL, 0 );
+    }
+    else if( strcmp( "--count", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      filter.count = strtoull( argv[++arg_pos], NULL, 0 );
+    }
+    else if( strcmp( "--pc", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      pc = argv[++arg_pos];
+    }
+    else if( strcmp( "--reg", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      // r3 or 3
+      const char* reg = argv[++arg_pos];
+      filter.reg = atoi( reg + (reg[0] == 'r') ) & 0x7;
+    }
+    else if( strcmp( "--mem", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      filter.mem = strtoul( argv[++arg_pos], NULL, 16 ) & 0xffff;
+    }
+    else if( strcmp( "--symbols", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      symbols_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--fetch", argv[arg_pos] ) == 0 )
+    {
+      filter.fetches = true;
+    }
+    else
+    {
+      printf("Unknown option %s\n", argv[arg_pos]);
+      return 1;
+    }
+    arg_pos++;
+  }
+  
+  SymFile symbols;
+  const SymFile* syms = NULL;
+  if( symbols_path != NULL )
+  {
+    const char* error;
+    if( !sym_open( &symbols, symbols_path, &error ) )
+    {
+      printf(error, symbols_path);
+      printf("\n");
+      return 1;
+    }
+    syms = &symbols;
+  }
+  
+  // a label, with a symbol file, or a hex address
+  if( pc != NULL )
+  {
+    filter.upc = syms != NULL ? sym_find_label( syms, pc ) : -1;
+    if( filter.upc < 0 )
+    {
+      filter.upc = strtoul( pc, NULL, 16 );
+    }
+  }
+  
+  int result = 1;
+  TraceFile trace;
+  if( strcmp( command, "info" ) == 0 && arg_pos + 1 == argc )
+  {
+    if( open_trace( &trace, argv[arg_pos] ) )
+    {
+      result = info( &trace );
+      trace_close( &trace );
+    }
+  }
+  else if( strcmp( command, "dump" ) == 0 && arg_pos + 1 == argc )
+  {
+    // the output is mostly much larger than the records that produce it
+    setvbuf( stdout, NULL, _IOFBF, 1 << 16 );
+    if( open_trace( &trace, argv[arg_pos] ) )
+    {
+      result = dump( &trace, syms, &filter );
+      trace_close( &trace );
+    }
+  }
+  else if( strcmp( command, "diff" ) == 0 && arg_pos + 2 == argc )
+  {
+    TraceFile other;
+    if( open_trace( &trace, argv[arg_pos] ) )
+    {
+      if( open_trace( &other, argv[arg_pos + 1] ) )
+      {
+        result = diff( &trace, &other, syms );
+        trace_close( &other );
+      }
+      trace_close( &trace );
+    }
+  }
+  else
+  {
+    printf("Expected ddtrace info trace, ddtrace dump [filters] trace or ddtrace diff trace1 trace2\n");
+  }
+  
+  if( syms != NULL )
+  {
+    sym_close( &symbols );
+  }
+  return result;
+}
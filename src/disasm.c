@@ -0,0 +1,574 @@
+#include "disasm.h"
+
+// micro operation fields, see the M_* masks in assembler.h
+#define W_AA(w) (((w) >> 13) & 0x7)
+#define W_BA(w) (((w) >> 9) & 0x7)
+#define W_DA(w) (((w) >> 1) & 0x7)
+
+// source forms of a micro operation, as parse_instruction encodes them
+#define FORM_NONE        0  // nothing assembles to it
+#define FORM_NOP         1  // nop
+#define FORM_MOV         2  // mov rD rB
+#define FORM_LOAD        3  // mov rD [rA], with BA = AA
+#define FORM_CONST       4  // mov rD 0|a|b|c
+#define FORM_ONE         5  // mov rD 1, with BA = CONST_1
+#define FORM_STORE       6  // mov [rA] rB
+#define FORM_STORE_CONST 7  // mov [rA] 0|a|b|c
+#define FORM_BINARY      8  // op rD rA rB
+#define FORM_UNARY       9  // op rD rA
+
+// the longest line written for one word, including a label operand
+#define LINE_MAX (64 + BUF_SIZE)
+
+static const char* CONST_NAMES[4] = { "0", "a", "b", "c" };
+
+// indexed by CND, P Z N from the high bit
+static const char* JUMP_NAMES[8] = {
+  "jmp", "jmpn", "jmpz", "jmpzn", "jmpp", "jmppn", "jmppz", "jmppzn"
+};
+
+// function unit codes of the arithmetic mnemonics, NULL for the others
+static const char* FS_MNEMONICS[16] = {
+  NULL, NULL, NULL, NULL, "add", "sub", "mul", "div",
+  "not", "and", "or", "nadd", "rsh", "lsh", "sar", NULL
+};
+
+void disasm_init( Disassembler* dis, const RomGeometry* geom, const SymFile* syms )
+{
+  memset( dis, 0, sizeof(Disassembler) );
+  dis->geom = *geom;
+  dis->syms = syms;
+  
+  uint32_t key;
+  for( key = 0; key < DISASM_KEYS; key++ )
+  {
+    // the inverse of DISASM_KEY
+    bool rw = key & 0x01;
+    uint32_t fs = (key >> 1) & 0xf;
+    bool mf = key & 0x20;
+    bool mb = key & 0x40;
+    bool mw = key & 0x80;
+    
+    // words with no form are written as a nop, which keeps the
+    // addresses after them
+    DisasmEntry* entry = &dis->table[key];
+    entry->mnemonic = "nop";
+    entry->form = FORM_NONE;
+    entry->base = 0;
+    
+    if( !rw && !mw )
+    {
+      // nothing is written, but any function other than F=0 sets the
+      // flags differently from a nop
+      if( fs == F_0 )
+      {
+        entry->form = FORM_NOP;
+      }
+    }
+    else if( !rw )
+    {
+      entry->mnemonic = "mov";
+      entry->form = mb ? FORM_STORE_CONST : FORM_STORE;
+      minstr_set( &entry->base, M_MW, 1 );
+      minstr_set( &entry->base, M_MB, mb );
+    }
+    else if( mw )
+    {
+      // writes a register and memory at once, which no instruction does
+    }
+    else if( mf )
+    {
+      entry->mnemonic = "mov";
+      entry->form = FORM_LOAD;
+      minstr_set( &entry->base, M_RW, 1 );
+      minstr_set( &entry->base, M_MF, 1 );
+      minstr_set( &entry->base, M_FS, F_B );
+    }
+    else if( fs == F_B )
+    {
+      entry->mnemonic = "mov";
+      entry->form = mb ? FORM_CONST : FORM_MOV;
+      minstr_set( &entry->base, M_RW, 1 );
+      minstr_set( &entry->base, M_MB, mb );
+      minstr_set( &entry->base, M_FS, F_B );
+    }
+    else if( fs == F_1 )
+    {
+      entry->mnemonic = "mov";
+      entry->form = FORM_ONE;
+      minstr_set( &entry->base, M_RW, 1 );
+      minstr_set( &entry->base, M_FS, F_1 );
+      minstr_set( &entry->base, M_BA, CONST_1 );
+    }
+    else if( FS_MNEMONICS[fs] != NULL )
+    {
+      // the unary functions only read the A bus, so MB makes no difference
+      bool unary = fs == F_NOT || fs == F_NADD || fs == F_RSH || fs == F_LSH || fs == F_SAR;
+      if( unary || !mb )
+      {
+        entry->mnemonic = FS_MNEMONICS[fs];
+        entry->form = unary ? FORM_UNARY : FORM_BINARY;
+        minstr_set( &entry->base, M_RW, 1 );
+        minstr_set( &entry->base, M_FS, fs );
+      }
+    }
+  }
+}
+
+void disasm_free( Disassembler* dis )
+{
+  free( dis->text );
+  free( dis->emitted );
+  if( dis->check_used )
+  {
+    free_state( &dis->check );
+  }
+  dis->text = NULL;
+  dis->emitted = NULL;
+  dis->check_used = false;
+}
+
+static int hex_value( int c )
+{
+  if( c >= '0' && c <= '9' ) return c - '0';
+  if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+  if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+  return -1;
+}
+
+bool read_rom_image( const uint8_t* data, size_t len, bool binary, const RomGeometry* geom,
+                     MicroInstruction* words, uint32_t capacity, uint32_t* count )
+{
+  int word_bytes = geom->word_bytes;
+  if( binary )
+  {
+    // most significant byte first, as write_binary packs them
+    if( len % word_bytes != 0 || len / word_bytes > capacity )
+    {
+      return false;
+    }
+    uint32_t n = len / word_bytes;
+    uint32_t i;
+    for( i = 0; i < n; i++ )
+    {
+      MicroInstruction w = 0;
+      int b;
+      for( b = 0; b < word_bytes; b++ )
+      {
+        w = w << 8 | data[i * word_bytes + b];
+      }
+      words[i] = w;
+    }
+    *count = n;
+    return true;
+  }
+  
+  const char* c = (const char*)data;
+  const char* end = c + len;
+  static const char header[] = "v2.0 raw";
+  if( len >= sizeof(header) - 1 && memcmp( c, header, sizeof(header) - 1 ) == 0 )
+  {
+    c += sizeof(header) - 1;
+  }
+  
+  uint64_t limit = (uint64_t)1 << geom->word_bits;
+  uint32_t n = 0;
+  while( true )
+  {
+    while( c < end && isspace( (unsigned char)*c ) )
+    {
+      c++;
+    }
+    if( c >= end )
+    {
+      break;
+    }
+    
+    // value, or repeat count followed by '*' and the value
+    uint64_t value = 0;
+    uint32_t repeat = 1;
+    int digits = 0;
+    while( c < end && hex_value( *c ) >= 0 && digits <= 2 * word_bytes )
+    {
+      value = value * 16 + hex_value( *c++ );
+      digits++;
+    }
+    if( c < end && *c == '*' )
+    {
+      // Logisim writes the run length in decimal
+      const char* d;
+      repeat = 0;
+      for( d = c - digits; d < c; d++ )
+      {
+        if( *d < '0' || *d > '9' )
+        {
+          return false;
+        }
+        repeat = repeat * 10 + (*d - '0');
+      }
+      c++;
+      value = 0;
+      digits = 0;
+      while( c < end && hex_value( *c ) >= 0 && digits <= 2 * word_bytes )
+      {
+        value = value * 16 + hex_value( *c++ );
+        digits++;
+      }
+    }
+    
+    if( digits == 0 || digits > 2 * word_bytes || value >= limit
+        || (c < end && !isspace( (unsigned char)*c )) )
+    {
+      return false;
+    }
+    if( repeat > capacity - n )
+    {
+      return false;
+    }
+    while( repeat-- > 0 )
+    {
+      words[n++] = (MicroInstruction)value;
+    }
+  }
+
+  *count = n;
+  return true;
+}
+
+/**
+* Makes room for another n characters of output
+*/
+static bool reserve( Disassembler* dis, size_t n )
+{
+  if( dis->len + n <= dis->capacity )
+  {
+    return true;
+  }
+  size_t capacity = dis->capacity == 0 ? 1 << 14 : dis->capacity;
+  while( capacity < dis->len + n )
+  {
+    capacity *= 2;
+  }
+  char* text = realloc( dis->text, capacity );
+  if( text == NULL )
+  {
+    return false;
+  }
+  dis->text = text;
+  dis->capacity = capacity;
+  return true;
+}
+
+static char* put_str( char* out, const char* str )
+{
+  while( *str != 0 )
+  {
+    *out++ = *str++;
+  }
+  return out;
+}
+
+static char* put_hex( char* out, uint32_t value, int digits )
+{
+  static const char HEX[] = "0123456789ABCDEF";
+  int d;
+  for( d = digits - 1; d >= 0; d-- )
+  {
+    out[d] = HEX[value & 0xf];
+    value >>= 4;
+  }
+  return out + digits;
+}
+
+static char* put_reg( char* out, uint32_t reg, bool mem )
+{
+  *out++ = ' ';
+  if( mem )
+  {
+    *out++ = '[';
+  }
+  *out++ = 'r';
+  *out++ = '0' + reg;
+  if( mem )
+  {
+    *out++ = ']';
+  }
+  return out;
+}
+
+/**
+* Decides which addresses get a line: the words the symbol file says
+* were assembled, or without one everything except long runs of zeros.
+* Anything else is zero once assembled again, since images are.  The
+* last word always gets one so the image comes out the same length.
+*/
+static void mark_emitted( Disassembler* dis, const MicroInstruction* words, uint32_t count )
+{
+  uint32_t addr;
+  if( dis->syms != NULL )
+  {
+    for( addr = 0; addr < count; addr++ )
+    {
+      uint32_t line;
+      uint32_t column;
+      dis->emitted[addr] = words[addr] != 0 || sym_line_at( dis->syms, addr, &line, &column );
+    }
+  }
+  else
+  {
+    addr = 0;
+    while( addr < count )
+    {
+      uint32_t run = 0;
+      while( addr + run < count && words[addr + run] == 0 )
+      {
+        run++;
+      }
+      bool skip = run >= DISASM_MIN_GAP;
+      uint32_t i;
+      for( i = 0; i < run; i++ )
+      {
+        dis->emitted[addr + i] = !skip;
+      }
+      addr += run;
+      if( addr < count )
+      {
+        dis->emitted[addr++] = true;
+      }
+    }
+  }
+  if( count > 0 )
+  {
+    dis->emitted[count - 1] = true;
+  }
+}
+
+/**
+* Writes the line of the word at addr at *pos, counting it if it does
+* not assemble back to the same word
+*/
+static void decode_word( Disassembler* dis, const MicroInstruction* words,
+                         uint32_t count, uint32_t addr, char** pos )
+{
+  const RomGeometry* geom = &dis->geom;
+  MicroInstruction w = words[addr];
+  MicroInstruction canonical = 0;
+  char* out = *pos;
+  *out++ = ' ';
+  
+  if( w & geom->mode )
+  {
+    uint32_t target = minstr_get( w, geom->next_addr );
+    if( target < geom->depth )
+    {
+      canonical = w & (geom->mode | geom->cond | geom->next_addr);
+      out = put_str( out, JUMP_NAMES[minstr_get( w, geom->cond )] );
+      *out++ = ' ';
+      
+      // a label only helps if it is defined, so only one at a word written out
+      uint32_t offset = 0;
+      const char* label = NULL;
+      if( dis->syms != NULL && target < count && dis->emitted[target] )
+      {
+        label = sym_label_before( dis->syms, target, &offset );
+      }
+      if( label != NULL && offset == 0 )
+      {
+        out = put_str( out, label );
+      }
+      else
+      {
+        *out++ = 'x';
+        out = put_hex( out, target, (geom->addr_bits + 3) / 4 );
+      }
+    }
+    else
+    {
+      out = put_str( out, "nop" );
+    }
+  }
+  else
+  {
+    const DisasmEntry* entry = &dis->table[DISASM_KEY( w )];
+    uint32_t da = W_DA( w );
+    uint32_t aa = W_AA( w );
+    uint32_t ba = W_BA( w );
+    
+    // constIn is 0 for the codes above C
+    uint32_t constant = ba <= CONST_C ? ba : CONST_0;
+    
+    canonical = entry->base;
+    out = put_str( out, entry->mnemonic );
+    switch( entry->form )
+    {
+      case FORM_MOV:
+        out = put_reg( out, da, false );
+        out = put_reg( out, ba, false );
+        minstr_set( &canonical, M_DA, da );
+        minstr_set( &canonical, M_BA, ba );
+        break;
+      
+      case FORM_LOAD:
+        out = put_reg( out, da, false );
+        out = put_reg( out, aa, true );
+        minstr_set( &canonical, M_DA, da );
+        minstr_set( &canonical, M_AA, aa );
+        minstr_set( &canonical, M_BA, aa );
+        break;
+      
+      case FORM_CONST:
+        out = put_reg( out, da, false );
+        *out++ = ' ';
+        out = put_str( out, CONST_NAMES[constant] );
+        minstr_set( &canonical, M_DA, da );
+        minstr_set( &canonical, M_BA, constant );
+        break;
+      
+      case FORM_ONE:
+        out = put_reg( out, da, false );
+        out = put_str( out, " 1" );
+        minstr_set( &canonical, M_DA, da );
+        break;
+      
+      case FORM_STORE:
+        out = put_reg( out, aa, true );
+        out = put_reg( out, ba, false );
+        minstr_set( &canonical, M_AA, aa );
+        minstr_set( &canonical, M_BA, ba );
+        break;
+      
+      case FORM_STORE_CONST:
+        out = put_reg( out, aa, true );
+        *out++ = ' ';
+        out = put_str( out, CONST_NAMES[constant] );
+        minstr_set( &canonical, M_AA, aa );
+        minstr_set( &canonical, M_BA, constant );
+        break;
+      
+      case FORM_BINARY:
+        out = put_reg( out, da, false );
+        out = put_reg( out, aa, false );
+        out = put_reg( out, ba, false );
+        minstr_set( &canonical, M_DA, da );
+        minstr_set( &canonical, M_AA, aa );
+        minstr_set( &canonical, M_BA, ba );
+        break;
+      
+      case FORM_UNARY:
+        out = put_reg( out, da, false );
+        out = put_reg( out, aa, false );
+        minstr_set( &canonical, M_DA, da );
+        minstr_set( &canonical, M_AA, aa );
+        break;
+      
+      default:
+        // a nop, or the nop standing in for a word with no form
+        break;
+    }
+  }
+  
+  if( canonical != w )
+  {
+    out = put_str( out, "  ; word " );
+    out = put_hex( out, w, geom->word_bytes * 2 );
+    dis->inexact++;
+  }
+  *out++ = '\n';
+  *pos = out;
+}
+
+bool disassemble( Disassembler* dis, const MicroInstruction* words, uint32_t count )
+{
+  const RomGeometry* geom = &dis->geom;
+  if( count > dis->emitted_capacity )
+  {
+    uint8_t* emitted = realloc( dis->emitted, count );
+    if( emitted == NULL )
+    {
+      return false;
+    }
+    dis->emitted = emitted;
+    dis->emitted_capacity = count;
+  }
+  mark_emitted( dis, words, count );
+  
+  dis->len = 0;
+  dis->inexact = 0;
+  if( !reserve( dis, LINE_MAX ) )
+  {
+    return false;
+  }
+  dis->len += sprintf( dis->text, "; assemble with --depth %u --word-bits %u --addr-bits %u\n",
+                       geom->depth, geom->word_bits, geom->addr_bits );
+  
+  const SymFile* syms = dis->syms;
+  uint32_t next = 0;        // where the assembler puts the next word
+  uint32_t addr;
+  for( addr = 0; addr < count; addr++ )
+  {
+    if( !dis->emitted[addr] )
+    {
+      continue;
+    }
+    if( !reserve( dis, 2 * LINE_MAX ) )
+    {
+      return false;
+    }
+    char* out = dis->text + dis->len;
+    if( addr != next )
+    {
+      out = put_str( out, "\n.org x" );
+      out = put_hex( out, addr, (geom->addr_bits + 3) / 4 );
+      *out++ = '\n';
+    }
+    
+    // only one label can go on a word, so several at one address come
+    // down to the one jumps to it are written with
+    uint32_t offset = 0;
+    const char* name = syms != NULL ? sym_label_before( syms, addr, &offset ) : NULL;
+    if( name != NULL && offset == 0 )
+    {
+      out = put_str( out, name );
+      *out++ = ':';
+      *out++ = '\n';
+    }
+    
+    decode_word( dis, words, count, addr, &out );
+    dis->len = out - dis->text;
+    next = addr + 1;
+  }
+  return true;
+}
+
+int64_t disasm_round_trip( Disassembler* dis, const MicroInstruction* words, uint32_t count,
+                           uint32_t* first )
+{
+  LexState state = &dis->check;
+  if( dis->check_used )
+  {
+    reuse_state( state, dis->text, dis->len );
+  }
+  else
+  {
+    init_state( state, dis->text, dis->len, &dis->geom );
+    dis->check_used = true;
+  }
+  if( !assemble( state ) )
+  {
+    return -1;
+  }
+  
+  uint32_t end = count > state->rom_used ? count : state->rom_used;
+  int64_t differ = 0;
+  uint32_t addr;
+  for( addr = 0; addr < end; addr++ )
+  {
+    MicroInstruction a = addr < count ? words[addr] : 0;
+    MicroInstruction b = addr < state->rom_used ? state->instructions[addr] : 0;
+    if( a != b && differ++ == 0 )
+    {
+      *first = addr;
+    }
+  }
+  return differ;
+}
@@ -0,0 +1,90 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "assembler.h"
+#include "symbols.h"
+
+/**
+* Disassembly of control store images (dda -d)
+*
+* A micro operation is decoded by looking up its RW, MW, MF, MB and FS
+* bits in a table built once from the forms parse_instruction encodes,
+* which gives the mnemonic, which of DA, AA and BA are operands and the
+* fixed bits of the word the assembler would produce.  A word that is
+* not exactly that word is still written as the closest form, so the
+* addresses stay put, but is marked with its real value in a comment.
+*
+* Jumps go to the labels of a symbol file where there is one at the
+* target, otherwise to a hex address.  Runs of zero words are skipped
+* with .org, except where the symbol file says they were assembled.
+*/
+
+// table index of a micro operation: RW, FS, MF, MB and MW
+#define DISASM_KEYS 256
+#define DISASM_KEY( w ) \
+  (((w) & M_RW) | ((w) & (M_FS | M_MF)) >> 3 | ((w) & M_MB) >> 6 | ((w) & M_MW) >> 9)
+
+// shortest run of zero words left out, without a symbol file
+#define DISASM_MIN_GAP 4
+
+typedef struct DisasmEntry
+{
+  const char* mnemonic;
+  uint8_t form;             // FORM_*, see disasm.c
+  MicroInstruction base;    // the fixed bits of the word it assembles to
+}
+DisasmEntry;
+
+typedef struct Disassembler
+{
+  RomGeometry geom;
+  const SymFile* syms;      // or NULL
+  DisasmEntry table[DISASM_KEYS];
+  
+  /** the source of the last image disassembled, not NUL terminated */
+  char* text;
+  size_t len;
+  size_t capacity;
+  
+  uint8_t* emitted;         // per address of the last image
+  uint32_t emitted_capacity;
+  uint32_t inexact;         // words of the last image with no exact form
+  
+  /** assembles the source again for disasm_round_trip */
+  struct LexState check;
+  bool check_used;
+}
+Disassembler;
+
+/**
+* Builds the decode table for the given geometry; syms may be NULL
+*/
+void disasm_init( Disassembler* dis, const RomGeometry* geom, const SymFile* syms );
+
+void disasm_free( Disassembler* dis );
+
+/**
+* Reads a control store image as written by write_logisim, or by
+* write_binary if binary, into at most capacity words.  Returns false
+* if it is malformed or too large.
+*/
+bool read_rom_image( const uint8_t* data, size_t len, bool binary, const RomGeometry* geom,
+                     MicroInstruction* words, uint32_t capacity, uint32_t* count );
+
+/**
+* Disassembles count words into dis->text.  Returns false if there is
+* not enough memory.
+*/
+bool disassemble( Disassembler* dis, const MicroInstruction* words, uint32_t count );
+
+/**
+* Assembles dis->text and compares the result with the words it was
+* disassembled from, an address past the end of either being zero.
+* Returns the number of addresses that differ, with first set to the
+* lowest, or -1 if the source does not assemble (the error is in
+* dis->check).
+*/
+int64_t disasm_round_trip( Disassembler* dis, const MicroInstruction* words, uint32_t count,
+                           uint32_t* first );
+
+#endif
@@ -0,0 +1,173 @@
+#include "lanes.h"
+
+#define LANE_LOOP( l ) for( l = 0; l < SIM_LANES; l++ )
+
+#define FLAGS( f ) ((f) == 0 ? COND_Z : ((f) & 0x8000) ? COND_N : COND_P)
+
+void lanes_start( DdLanes* lanes, const DdSim* sim, const uint16_t ir[SIM_LANES] )
+{
+  int l;
+  LANE_LOOP( l )
+  {
+    int c;
+    for( c = 0; c < 8; c++ )
+    {
+      lanes->file[SIM_FILE_CONSTS + c][l] = 0;
+    }
+    lanes->file[SIM_FILE_CONSTS + CONST_A][l] = IR_A( ir[l] );
+    lanes->file[SIM_FILE_CONSTS + CONST_B][l] = IR_B( ir[l] );
+    lanes->file[SIM_FILE_CONSTS + CONST_C][l] = IR_C( ir[l] );
+    lanes->file[SIM_FILE_SINK][l] = 0;
+    
+    lanes->upc[l] = sim->dispatch[IR_OP( ir[l] )];
+    lanes->cycles[l] = 0;
+    lanes->status[l] = IR_OP( ir[l] ) == 0 || lanes->upc[l] == sim->fetch_addr
+                       ? SIM_END : SIM_RUNNING;
+  }
+}
+
+/**
+* Function unit over every lane, with the select hoisted out of the loop
+* so each case vectorises
+*/
+static void lanes_function( int fs, const uint16_t* a, const uint16_t* b, uint16_t* f )
+{
+  int l;
+  
+  #define FN( expr ) LANE_LOOP( l ) { f[l] = (uint16_t)(expr); } break
+  
+  switch( fs )
+  {
+    case F_0:    FN( 0 );
+    case F_1:    FN( 1 );
+    case F_A:    FN( a[l] );
+    case F_B:    FN( b[l] );
+    case F_ADD:  FN( a[l] + b[l] );
+    case F_SUB:  FN( a[l] - b[l] );
+    case F_MUL:  FN( a[l] * b[l] );
+    case F_DIV:  FN( b[l] == 0 ? 0xffff : a[l] / b[l] );
+    case F_NOT:  FN( ~a[l] );
+    case F_AND:  FN( a[l] & b[l] );
+    case F_OR:   FN( a[l] | b[l] );
+    case F_NADD: FN( -a[l] );
+    case F_RSH:  FN( a[l] >> 1 );
+    case F_LSH:  FN( a[l] << 1 );
+    case F_SAR:  FN( (a[l] >> 1) | (a[l] & 0x8000) );
+    case F_MOV:  FN( a[l] );
+  }
+  
+  #undef FN
+}
+
+/**
+* Executes op for the lanes whose mask is all ones
+*/
+static void lanes_step( DdLanes* lanes, const DdSim* sim, const SimOp* op,
+                        const uint16_t mask[SIM_LANES] )
+{
+  uint32_t next = op->next - sim->ops;
+  uint32_t target = op->target != NULL ? (uint32_t)(op->target - sim->ops) : 0;
+  int l;
+  
+  if( op->word & sim->geom.mode )
+  {
+    LANE_LOOP( l )
+    {
+      bool taken = op->cond == 0 || (op->cond & lanes->flags[l]);
+      uint32_t to = taken ? target : next;
+      lanes->upc[l] = mask[l] ? to : lanes->upc[l];
+    }
+    return;
+  }
+  
+  const uint16_t* a = lanes->file[op->a];
+  const uint16_t* b = lanes->file[op->b];
+  uint16_t f[SIM_LANES] = { 0 };   // every fs is a case, but gcc cannot tell
+  lanes_function( op->fs, a, b, f );
+  
+  const uint16_t* result = f;
+  uint16_t data[SIM_LANES];
+  bool load = (op->word & M_RW) && (op->word & M_MF);
+  if( load || (op->word & M_MW) )
+  {
+    // every lane has its own address, so memory goes a lane at a time;
+    // lanes that are not running may hold any address, so they still wrap
+    LANE_LOOP( l )
+    {
+      uint16_t addr = a[l] % SIM_LANE_MEM;
+      data[l] = lanes->mem[addr][l];
+      if( mask[l] && a[l] >= SIM_LANE_MEM )
+      {
+        lanes->status[l] = SIM_OUT_OF_WINDOW;
+      }
+      else if( mask[l] && (op->word & M_MW) )
+      {
+        lanes->mem[addr][l] = b[l];
+      }
+    }
+    if( load )
+    {
+      result = data;
+    }
+  }
+  
+  uint16_t* d = lanes->file[op->d];
+  LANE_LOOP( l )
+  {
+    d[l] = (result[l] & mask[l]) | (d[l] & ~mask[l]);
+  }
+  LANE_LOOP( l )
+  {
+    uint8_t flags = FLAGS( f[l] );
+    lanes->flags[l] = mask[l] ? flags : lanes->flags[l];
+    lanes->upc[l] = mask[l] ? next : lanes->upc[l];
+  }
+}
+
+uint64_t lanes_run( DdLanes* lanes, const DdSim* sim, uint64_t max_cycles )
+{
+  uint64_t steps = 0;
+  int l;
+  
+  while( true )
+  {
+    // the lowest address any running lane is at
+    uint32_t upc = UINT32_MAX;
+    LANE_LOOP( l )
+    {
+      if( lanes->status[l] == SIM_RUNNING && lanes->upc[l] < upc )
+      {
+        upc = lanes->upc[l];
+      }
+    }
+    if( upc == UINT32_MAX )
+    {
+      return steps;
+    }
+    
+    uint16_t mask[SIM_LANES];
+    LANE_LOOP( l )
+    {
+      mask[l] = lanes->status[l] == SIM_RUNNING && lanes->upc[l] == upc ? 0xffff : 0;
+    }
+    
+    lanes_step( lanes, sim, &sim->ops[upc], mask );
+    steps++;
+    
+    LANE_LOOP( l )
+    {
+      if( mask[l] && lanes->status[l] == SIM_RUNNING )
+      {
+        lanes->cycles[l]++;
+        if( lanes->upc[l] == sim->fetch_addr )
+        {
+          lanes->status[l] = SIM_END;
+        }
+        else if( lanes->cycles[l] >= max_cycles )
+        {
+          lanes->status[l] = SIM_CYCLE_LIMIT;
+        }
+      }
+    }
+  }
+}
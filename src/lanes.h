@@ -0,0 +1,72 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "sim.h"
+
+/**
+* Lockstep simulation of many DDmini data paths
+*
+* SIM_LANES independent machines run the same control store side by
+* side, one macro instruction each.  Registers, constIn and memory are
+* kept as structure of arrays (one row of SIM_LANES values per register
+* or memory word) so each micro operation runs as a fixed length loop
+* over the lanes, which the compiler can vectorise.  The Makefile does
+* not ask for any particular instruction set, so how wide that goes is
+* up to the compiler's defaults for the target.
+*
+* Lanes that take different sides of a PZN branch are handled with a
+* lane mask: each step executes the lowest micro address any running
+* lane is at, for just the lanes that are there.  Routines mostly run
+* forwards, so diverged lanes meet up again at the same address.
+*
+* A lane starts at its opcode's slot and finishes when it jumps back to
+* the idle word, which is not executed.
+*
+* Memory is only a window of the lowest SIM_LANE_MEM words.  That is
+* enough for routines like micro.asm's, which only address memory
+* through the 4-bit A, B and C fields.  A lane that reads or writes an
+* address outside the window stops with SIM_OUT_OF_WINDOW rather than
+* touching a word it does not have.
+*/
+
+#ifndef SIM_LANES
+#define SIM_LANES 16
+#endif
+
+#ifndef SIM_LANE_MEM
+#define SIM_LANE_MEM 16
+#endif
+
+// lane status, beside the SIM_* ones of sim.h
+#define SIM_OUT_OF_WINDOW 4   // addressed memory past SIM_LANE_MEM
+
+typedef struct DdLanes
+{
+  /** registers, constIn and the sink, laid out like SimOp file indices */
+  uint16_t file[SIM_FILE_SIZE][SIM_LANES];
+  uint16_t mem[SIM_LANE_MEM][SIM_LANES];
+  uint8_t flags[SIM_LANES];
+  
+  uint32_t upc[SIM_LANES];
+  uint64_t cycles[SIM_LANES];
+  int status[SIM_LANES];    // SIM_RUNNING, SIM_END once back at idle,
+                            // SIM_CYCLE_LIMIT or SIM_OUT_OF_WINDOW
+}
+DdLanes;
+
+/**
+* Loads one macro instruction into each lane and points it at its slot.
+* Registers, flags and memory are left as they are, so the caller can
+* set up operands first.  Lanes with opcode 0 are not run.
+*/
+void lanes_start( DdLanes* lanes, const DdSim* sim, const uint16_t ir[SIM_LANES] );
+
+/**
+* Runs the lanes against the control store decoded in sim until each one
+* is back at the idle word, has executed max_cycles microcycles or has
+* addressed memory outside the window.
+* Returns the number of steps, each executing one word for some lanes.
+*/
+uint64_t lanes_run( DdLanes* lanes, const DdSim* sim, uint64_t max_cycles );
+
+#endif
@@ -0,0 +1,280 @@
+#include "assembler.h"
+
+/*
+* Layout of relocatable sections.
+*
+* A source that uses .section is assembled in layout mode: the .org
+* sections (and any code before the first directive, at address 0) stay
+* where they are written and must not overlap, and every .section is then
+* given the lowest free run of addresses it fits in, largest first, from
+* a bitmap of the words already taken.
+*/
+
+#define WORD_BITS 64
+
+typedef struct Occupancy
+{
+  uint64_t* bits;           // one per address of the control store
+  uint32_t depth;
+}
+Occupancy;
+
+static bool is_taken( const Occupancy* map, uint32_t addr )
+{
+  return (map->bits[addr / WORD_BITS] >> (addr % WORD_BITS)) & 1;
+}
+
+static void take( Occupancy* map, uint32_t addr, uint32_t count )
+{
+  for( ; count > 0; addr++, count-- )
+  {
+    map->bits[addr / WORD_BITS] |= (uint64_t)1 << (addr % WORD_BITS);
+  }
+}
+
+/**
+* Lowest address of count free words in a row, or depth if there is none
+*/
+static uint32_t find_free( const Occupancy* map, uint32_t count )
+{
+  uint32_t run = 0;
+  uint32_t addr = 0;
+  while( addr < map->depth && run < count )
+  {
+    // skip whole words that are full
+    if( addr % WORD_BITS == 0 && map->bits[addr / WORD_BITS] == UINT64_MAX )
+    {
+      run = 0;
+      addr += WORD_BITS;
+      continue;
+    }
+    run = is_taken( map, addr ) ? 0 : run + 1;
+    addr++;
+  }
+  return run == count ? addr - count : map->depth;
+}
+
+/**
+* Words a section will take once placed
+*/
+static uint32_t section_size( LexState state, const IrSection* section )
+{
+  uint32_t size = 0;
+  uint32_t i;
+  for( i = section->first; i < section->first + section->count; i++ )
+  {
+    size += !(state->ir[i].flags & IR_DEAD);
+  }
+  return size;
+}
+
+/**
+* Reports an error at the directive that started a section
+*/
+static void section_error( char* msg, const IrSection* section, LexState state )
+{
+  state->cur = state->src + section->src_offset;
+  error( msg, state );
+}
+
+void layout_sections( LexState state )
+{
+  uint32_t relocatable = 0;
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    relocatable += state->sections[s].relocatable;
+  }
+  if( relocatable == 0 )
+  {
+    return;
+  }
+  
+  Occupancy map;
+  map.depth = state->geom.depth;
+  map.bits = calloc( (map.depth + WORD_BITS - 1) / WORD_BITS, sizeof(uint64_t) );
+  uint32_t* order = malloc( relocatable * sizeof(uint32_t) );
+  uint32_t* sizes = malloc( state->section_count * sizeof(uint32_t) );
+  if( map.bits == NULL || order == NULL || sizes == NULL )
+  {
+    free( map.bits );
+    free( order );
+    free( sizes );
+    error( "Out of memory", state );
+  }
+  
+  // pinned sections first; any word already taken is an overlap
+  uint32_t n = 0;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    sizes[s] = section_size( state, section );
+    if( section->relocatable )
+    {
+      order[n++] = s;
+      continue;
+    }
+    
+    uint32_t addr;
+    for( addr = section->origin; addr < section->origin + sizes[s]; addr++ )
+    {
+      if( addr >= map.depth || is_taken( &map, addr ) )
+      {
+        free( map.bits );
+        free( order );
+        free( sizes );
+        section_error( addr >= map.depth ? "ROM storage exceeded" : "Section overlaps another",
+                       section, state );
+      }
+    }
+    take( &map, section->origin, sizes[s] );
+  }
+  
+  // largest first, in source order among equals, leaves the fewest holes
+  uint32_t i;
+  for( i = 1; i < n; i++ )
+  {
+    uint32_t key = order[i];
+    uint32_t j = i;
+    while( j > 0 && sizes[order[j - 1]] < sizes[key] )
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = key;
+  }
+  
+  for( i = 0; i < n; i++ )
+  {
+    IrSection* section = &state->sections[order[i]];
+    uint32_t size = sizes[order[i]];
+    if( size == 0 )
+    {
+      section->origin = 0;
+      continue;
+    }
+    
+    // running off the end would land in whatever got placed after it
+    MicroInstruction last = 0;
+    uint32_t k;
+    for( k = section->first + section->count; k > section->first; k-- )
+    {
+      if( !(state->ir[k - 1].flags & IR_DEAD) )
+      {
+        last = state->ir[k - 1].word;
+        break;
+      }
+    }
+    if( !(last & state->geom.mode) || minstr_get( last, state->geom.cond ) != 0 )
+    {
+      free( map.bits );
+      free( order );
+      free( sizes );
+      section_error( "Section must end with an unconditional jump", section, state );
+    }
+    
+    uint32_t origin = find_free( &map, size );
+    if( origin == map.depth )
+    {
+      free( map.bits );
+      free( order );
+      free( sizes );
+      section_error( "ROM storage exceeded", section, state );
+    }
+    take( &map, origin, size );
+    section->origin = origin;
+  }
+  
+  free( map.bits );
+  free( order );
+  free( sizes );
+}
+
+void write_layout_report( FILE* out_file, LexState state )
+{
+  int addr_digits = (state->geom.addr_bits + 3) / 4;
+  int addr_width = addr_digits > 6 ? addr_digits : 6;
+  fprintf( out_file, "%-*s %5s %5s  %-8s %s\n", addr_width, "origin", "size", "line",
+           "kind", "label" );
+  
+  uint8_t* used = calloc( state->geom.depth, 1 );
+  if( used == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  
+  // lines are counted incrementally, the sections are in source order
+  int line = 1;
+  const char* c = state->src;
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    uint32_t size = section_size( state, section );
+    if( size == 0 )
+    {
+      continue;
+    }
+    const char* dir = state->src + section->src_offset;
+    while( c < dir )
+    {
+      line += *c++ == '\n';
+    }
+    
+    // the first label in the section names it, internal ones aside
+    const char* name = "";
+    uint32_t first = section->first + section->count;
+    uint32_t id;
+    for( id = 0; id < state->labels.count; id++ )
+    {
+      uint32_t instr = state->labels.labels[id].instr;
+      if( instr > section->first && instr <= first
+          && state->labels.names[state->labels.labels[id].name] != '.' )
+      {
+        first = instr - 1;
+        name = state->labels.names + state->labels.labels[id].name;
+      }
+    }
+    
+    uint32_t addr;
+    for( addr = section->origin; addr < section->origin + size && addr < state->geom.depth; addr++ )
+    {
+      used[addr] = 1;
+    }
+    
+    const char* kind = section->relocatable ? "section" : "org";
+    fprintf( out_file, "%0*X%*s %5u %5d  ", addr_digits, section->origin,
+             addr_width - addr_digits, "", size, line );
+    if( name[0] != 0 )
+    {
+      fprintf( out_file, "%-8s %s\n", kind, name );
+    }
+    else
+    {
+      fprintf( out_file, "%s\n", kind );
+    }
+  }
+  
+  uint32_t taken = 0;
+  uint32_t runs = 0;
+  uint32_t largest = 0;
+  uint32_t run = 0;
+  uint32_t addr;
+  for( addr = 0; addr <= state->geom.depth; addr++ )
+  {
+    if( addr < state->geom.depth && !used[addr] )
+    {
+      run++;
+      continue;
+    }
+    taken += addr < state->geom.depth;
+    runs += run > 0;
+    largest = run > largest ? run : largest;
+    run = 0;
+  }
+  free( used );
+  
+  fprintf( out_file, "\n%u of %u words used (%u%%), %u free in %u run%s, largest %u\n",
+           taken, state->geom.depth, (uint32_t)((uint64_t)taken * 100 / state->geom.depth),
+           state->geom.depth - taken, runs, runs == 1 ? "" : "s", largest );
+}
@@ -0,0 +1,964 @@
+#include "assembler.h"
+#include "batch.h"
+#include "sim.h"
+#include "lanes.h"
+#include "verify.h"
+#include "aot.h"
+#include "cycles.h"
+#include "trace.h"
+#include "symbols.h"
+#include "disasm.h"
+#include "binfile.h"
+
+/**
+* Options for running the assembled ROM in the simulator
+*/
+typedef struct SimArgs
+{
+  const char* program_path;
+  const char* mem_path;
+  const char* mem_out_path;
+  const char* fetch_label;
+  uint64_t max_cycles;
+  const char* profile_path; // where --sim writes its profile, or NULL
+  const char* coverage_path;         // --sim coverage report, or NULL
+  const char* coverage_listing_path; // listing with counts, or NULL
+  const char* trace_path;   // where --sim writes its trace, or NULL
+  
+  int sweep_op;             // opcode to sweep, 0 for none
+  uint32_t sweep_fills;     // memory fills per operand combination
+  
+  int verify_op;            // opcode to verify, -1 for all, 0 for none
+  VerifyOptions verify;
+}
+SimArgs;
+
+static char* read_file( const char* path, size_t* len )
+{
+  FILE* file = fopen( path, "rb" );
+  if( file == NULL )
+  {
+    return NULL;
+  }
+  char* text = load_source( file, len );
+  fclose( file );
+  return text;
+}
+
+/**
+* Reads a word image from the given file into words, returning false
+* (after reporting why) if that fails
+*/
+static bool read_word_file( const char* path, uint16_t* words, uint32_t capacity,
+                            uint32_t* count )
+{
+  size_t len = 0;
+  char* text = read_file( path, &len );
+  if( text == NULL )
+  {
+    printf("Unable to read %s\n", path);
+    return false;
+  }
+  bool ok = read_word_image( text, len, words, capacity, count );
+  free( text );
+  if( !ok )
+  {
+    printf("%s is not an image of 16-bit words\n", path);
+  }
+  return ok;
+}
+
+static const char* SIM_STATUS[] = {
+  "running",
+  "halted",
+  "end of program",
+  "cycle limit"
+};
+
+/**
+* Runs the macro program against the assembled ROM and reports the
+* final machine state
+*/
+static int simulate( LexState state, const SimArgs* args )
+{
+  int fetch_addr = lookup_label( args->fetch_label, state );
+  if( fetch_addr < 0 )
+  {
+    fetch_addr = 0;
+  }
+  
+  DdSim sim;
+  uint16_t* program = malloc( SIM_MEM_WORDS * sizeof(uint16_t) );
+  if( program == NULL
+      || !sim_init( &sim, state->instructions, state->rom_used,
+                    &state->geom, fetch_addr, state->opcode_map ) )
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+  
+  uint32_t program_len = 0;
+  uint32_t mem_len = 0;
+  if( !read_word_file( args->program_path, program, SIM_MEM_WORDS, &program_len )
+      || (args->mem_path != NULL
+          && !read_word_file( args->mem_path, sim.mem, SIM_MEM_WORDS, &mem_len )) )
+  {
+    sim_free( &sim );
+    free( program );
+    return 1;
+  }
+  sim_load_program( &sim, program, program_len );
+  
+  // counting every word is slower, so only when something reads the counts
+  int status;
+  uint64_t* executed = NULL;
+  uint64_t* taken = NULL;
+  bool traced = true;
+  bool counted = args->profile_path != NULL || args->coverage_path != NULL
+                 || args->coverage_listing_path != NULL;
+  if( counted && args->trace_path != NULL )
+  {
+    printf("--trace cannot be combined with --profile-out or --coverage\n");
+    sim_free( &sim );
+    free( program );
+    return 1;
+  }
+  if( args->trace_path != NULL )
+  {
+    FILE* trace_file = fopen( args->trace_path, "wb" );
+    TraceWriter trace;
+    if( trace_file == NULL || !trace_begin( &trace, trace_file, &sim ) )
+    {
+      printf("Unable to write trace %s\n", args->trace_path);
+      if( trace_file != NULL )
+      {
+        fclose( trace_file );
+      }
+      sim_free( &sim );
+      free( program );
+      return 1;
+    }
+    status = sim_run_traced( &sim, args->max_cycles, &trace );
+    traced = trace_finish( &trace );
+    fclose( trace_file );
+  }
+  else if( counted )
+  {
+    executed = calloc( state->geom.depth, sizeof(uint64_t) );
+    taken = calloc( state->geom.depth, sizeof(uint64_t) );
+    if( executed == NULL || taken == NULL )
+    {
+      printf("Out of memory\n");
+      free( executed );
+      free( taken );
+      sim_free( &sim );
+      free( program );
+      return 1;
+    }
+    status = sim_run_profiled( &sim, args->max_cycles, executed, taken );
+  }
+  else
+  {
+    status = sim_run( &sim, args->max_cycles );
+  }
+  
+  printf("status: %s\n", SIM_STATUS[status]);
+  printf("cycles: %llu\n", (unsigned long long)sim.cycles);
+  printf("instructions: %llu\n", (unsigned long long)sim.instructions);
+  int r;
+  for( r = 0; r < SIM_REGS; r++ )
+  {
+    printf("r%d: %04x%s", r, sim.regs[r], r == SIM_REGS - 1 ? "\n" : "  ");
+  }
+  
+  if( !traced )
+  {
+    printf("Unable to write trace %s\n", args->trace_path);
+    status = -1;
+  }
+  
+  if( args->mem_out_path != NULL )
+  {
+    FILE* mem_file = fopen( args->mem_out_path, "w" );
+    if( mem_file == NULL )
+    {
+      printf("Unable to open %s\n", args->mem_out_path);
+      status = -1;
+    }
+    else
+    {
+      write_word_image( mem_file, sim.mem, SIM_MEM_WORDS );
+      fclose( mem_file );
+    }
+  }
+  
+  if( args->profile_path != NULL )
+  {
+    FILE* profile_file = fopen( args->profile_path, "w" );
+    if( profile_file == NULL )
+    {
+      printf("Unable to write profile %s\n", args->profile_path);
+      status = -1;
+    }
+    else
+    {
+      write_profile( profile_file, state, executed, taken );
+      fclose( profile_file );
+    }
+  }
+  
+  if( args->coverage_path != NULL )
+  {
+    FILE* coverage_file = fopen( args->coverage_path, "w" );
+    if( coverage_file == NULL )
+    {
+      printf("Unable to open %s\n", args->coverage_path);
+      status = -1;
+    }
+    else
+    {
+      write_coverage( coverage_file, state, executed, taken );
+      fclose( coverage_file );
+    }
+  }
+  
+  if( args->coverage_listing_path != NULL )
+  {
+    FILE* listing_file = fopen( args->coverage_listing_path, "w" );
+    if( listing_file == NULL )
+    {
+      printf("Unable to open %s\n", args->coverage_listing_path);
+      status = -1;
+    }
+    else
+    {
+      write_listing( listing_file, state, executed );
+      fclose( listing_file );
+    }
+  }
+  
+  free( executed );
+  free( taken );
+  sim_free( &sim );
+  free( program );
+  return status == SIM_CYCLE_LIMIT || status < 0 ? 1 : 0;
+}
+
+/**
+* Runs one opcode for every combination of its A, B and C fields against
+* pseudo random fills of the memory window, SIM_LANES at a time, and
+* reports the spread of cycle counts and a checksum of the results
+*/
+static int sweep( LexState state, const SimArgs* args );
+
+/**
+* Checks opcodes against their golden models and reports the first
+* mismatching input of each
+*/
+static int verify( LexState state, const SimArgs* args )
+{
+  int fetch_addr = lookup_label( args->fetch_label, state );
+  if( fetch_addr < 0 )
+  {
+    fetch_addr = 0;
+  }
+  
+  DdSim sim;
+  if( !sim_init( &sim, state->instructions, state->rom_used, &state->geom, fetch_addr,
+                 state->opcode_map ) )
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+  
+  int failed = 0;
+  int opcode;
+  for( opcode = 1; opcode < 16; opcode++ )
+  {
+    const char* description = NULL;
+    if( (args->verify_op > 0 && opcode != args->verify_op)
+        || golden_model( opcode, &description ) == NULL )
+    {
+      continue;
+    }
+    
+    VerifyResult result;
+    verify_opcode( &sim, opcode, &args->verify, &result );
+    if( !result.mismatch )
+    {
+      printf("opcode %X  %s: ok, %llu inputs\n", opcode, description,
+             (unsigned long long)result.inputs);
+      continue;
+    }
+    
+    failed++;
+    printf("opcode %X  %s: MISMATCH\n", opcode, description);
+    printf("  ir %04x", result.ir);
+    if( result.status == SIM_OUT_OF_WINDOW )
+    {
+      printf(", addressed memory outside the %d word lane window", SIM_LANE_MEM);
+    }
+    else if( result.status != SIM_END )
+    {
+      printf(", did not return to idle");
+    }
+    printf("\n");
+    
+    int w;
+    for( w = 0; w < SIM_LANE_MEM; w++ )
+    {
+      if( result.actual[w] != result.expected[w] )
+      {
+        printf("  M[%X] was %04x, expected %04x, got %04x\n",
+               w, result.initial[w], result.expected[w], result.actual[w]);
+      }
+    }
+    printf("  inputs: M[B]=%04x M[C]=%04x\n",
+           result.initial[IR_B( result.ir ) % SIM_LANE_MEM],
+           result.initial[IR_C( result.ir ) % SIM_LANE_MEM]);
+  }
+  
+  if( args->verify_op > 0 && golden_model( args->verify_op, NULL ) == NULL )
+  {
+    printf("opcode %X has no golden model\n", args->verify_op);
+    failed++;
+  }
+  
+  sim_free( &sim );
+  return failed > 0 ? 1 : 0;
+}
+
+static int sweep( LexState state, const SimArgs* args )
+{
+  int fetch_addr = lookup_label( args->fetch_label, state );
+  if( fetch_addr < 0 )
+  {
+    fetch_addr = 0;
+  }
+  
+  DdSim sim;
+  if( !sim_init( &sim, state->instructions, state->rom_used, &state->geom, fetch_addr,
+                 state->opcode_map ) )
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+  
+  DdLanes* lanes = calloc( 1, sizeof(DdLanes) );
+  uint64_t steps = 0;
+  uint64_t min_cycles = UINT64_MAX;
+  uint64_t max_cycles = 0;
+  uint64_t limited = 0;
+  uint64_t outside = 0;
+  uint32_t checksum = 2166136261u;
+  uint32_t seed = 1;
+  
+  uint32_t fill;
+  for( fill = 0; fill < args->sweep_fills; fill++ )
+  {
+    uint32_t operands;
+    for( operands = 0; operands < 0x1000; operands += SIM_LANES )
+    {
+      uint16_t ir[SIM_LANES];
+      int l;
+      int i;
+      memset( lanes, 0, sizeof(DdLanes) );
+      for( l = 0; l < SIM_LANES; l++ )
+      {
+        ir[l] = (uint16_t)((args->sweep_op << 12) | ((operands + l) & 0xfff));
+        for( i = 0; i < SIM_LANE_MEM; i++ )
+        {
+          // xorshift32
+          seed ^= seed << 13;
+          seed ^= seed >> 17;
+          seed ^= seed << 5;
+          lanes->mem[i][l] = (uint16_t)seed;
+        }
+      }
+      
+      lanes_start( lanes, &sim, ir );
+      steps += lanes_run( lanes, &sim, args->max_cycles );
+      
+      for( l = 0; l < SIM_LANES; l++ )
+      {
+        uint64_t cycles = lanes->cycles[l];
+        min_cycles = cycles < min_cycles ? cycles : min_cycles;
+        max_cycles = cycles > max_cycles ? cycles : max_cycles;
+        limited += lanes->status[l] == SIM_CYCLE_LIMIT;
+        outside += lanes->status[l] == SIM_OUT_OF_WINDOW;
+        
+        // FNV-1a over the registers and memory of the lane
+        for( i = 0; i < SIM_REGS + SIM_LANE_MEM; i++ )
+        {
+          uint16_t v = i < SIM_REGS ? lanes->file[i][l] : lanes->mem[i - SIM_REGS][l];
+          checksum = (checksum ^ (v & 0xff)) * 16777619u;
+          checksum = (checksum ^ (v >> 8)) * 16777619u;
+        }
+      }
+    }
+  }
+  
+  printf("lanes: %llu\n", (unsigned long long)args->sweep_fills * 0x1000);
+  printf("steps: %llu\n", (unsigned long long)steps);
+  printf("cycles: %llu..%llu\n", (unsigned long long)min_cycles, (unsigned long long)max_cycles);
+  printf("cycle limit: %llu\n", (unsigned long long)limited);
+  printf("outside window: %llu\n", (unsigned long long)outside);
+  printf("checksum: %08x\n", checksum);
+  
+  free( lanes );
+  sim_free( &sim );
+  return limited > 0 || outside > 0 ? 1 : 0;
+}
+
+/**
+* dda -d: writes the source of an image to outfile (or stdout), or with
+* --round-trip checks that each of the images assembles back to itself
+*/
+static int disassemble_images( const char** paths, int count, const RomGeometry* geom,
+                               bool binary, const char* symbols_path, bool round_trip )
+{
+  if( count < 1 || (!round_trip && count > 2) )
+  {
+    printf("Expected dda -d [options] image [outfile] or dda --round-trip [options] image...\n");
+    return 1;
+  }
+  
+  SymFile symbols;
+  const SymFile* syms = NULL;
+  if( symbols_path != NULL )
+  {
+    const char* error;
+    if( !sym_open( &symbols, symbols_path, &error ) )
+    {
+      printf(error, symbols_path);
+      printf("\n");
+      return 1;
+    }
+    syms = &symbols;
+    if( symbols.depth != geom->depth )
+    {
+      printf("%s is for a control store of %u words, not %u\n",
+             symbols_path, symbols.depth, geom->depth);
+      sym_close( &symbols );
+      return 1;
+    }
+  }
+  
+  // one of each, reused for every image
+  MicroInstruction* words = malloc( geom->depth * sizeof(MicroInstruction) );
+  Disassembler* dis = malloc( sizeof(Disassembler) );
+  if( words == NULL || dis == NULL )
+  {
+    printf("Out of memory\n");
+    free( words );
+    free( dis );
+    return 1;
+  }
+  disasm_init( dis, geom, syms );
+  
+  int images = round_trip ? count : 1;
+  int failed = 0;
+  int i;
+  for( i = 0; i < images; i++ )
+  {
+    const char* path = paths[i];
+    size_t len = 0;
+    const uint8_t* data = map_file( path, true, &len );
+    if( data == NULL )
+    {
+      printf("Unable to read %s\n", path);
+      failed++;
+      continue;
+    }
+    uint32_t word_count = 0;
+    bool ok = read_rom_image( data, len, binary, geom, words, geom->depth, &word_count );
+    unmap_file( data, len );
+    if( !ok )
+    {
+      printf("%s is not an image of %d-bit words for a control store of %u words\n",
+             path, geom->word_bits, geom->depth);
+      failed++;
+      continue;
+    }
+    
+    if( !disassemble( dis, words, word_count ) )
+    {
+      printf("Out of memory\n");
+      failed++;
+      break;
+    }
+    
+    if( !round_trip )
+    {
+      FILE* out_file = count > 1 ? fopen( paths[1], "w" ) : stdout;
+      if( out_file == NULL )
+      {
+        printf("Unable to open %s\n", paths[1]);
+        failed++;
+        break;
+      }
+      fwrite( dis->text, 1, dis->len, out_file );
+      if( out_file != stdout )
+      {
+        fclose( out_file );
+        if( dis->inexact > 0 )
+        {
+          printf("%u words have no exact source form\n", dis->inexact);
+        }
+      }
+      continue;
+    }
+    
+    uint32_t first = 0;
+    int64_t differ = disasm_round_trip( dis, words, word_count, &first );
+    if( differ < 0 )
+    {
+      printf("%s: Error: %s @ line %d col %d\n", path, dis->check.error_msg,
+             dis->check.error_line, dis->check.error_column);
+      failed++;
+    }
+    else if( differ > 0 )
+    {
+      printf("%s: %lld words differ, the first at %X\n", path, (long long)differ, first);
+      failed++;
+    }
+  }
+  if( round_trip )
+  {
+    printf("%d of %d images round trip\n", images - failed, images);
+  }
+  
+  disasm_free( dis );
+  free( dis );
+  free( words );
+  if( syms != NULL )
+  {
+    sym_close( &symbols );
+  }
+  return failed > 0 ? 1 : 0;
+}
+
+int main( int argc, const char* argv[] )
+{
+  FILE* src_file = NULL;
+  FILE* out_file = NULL;
+  FILE* listing_file = NULL;
+  FILE* c_file = NULL;
+  FILE* cycles_file = NULL;
+  FILE* layout_file = NULL;
+  FILE* symbols_file = NULL;
+  FILE* map_file = NULL;
+  const char* c_name = "ddrom";
+  bool binary_output = false;
+  int optimize = 0;
+  uint32_t rom_depth = ROM_SIZE;
+  int word_bits = 0;
+  int addr_bits = 0;
+  bool batch = false;
+  const char* manifest = NULL;
+  int threads = 0;
+  const char* profile_use = NULL;
+  const char* symbols_path = NULL;
+  bool disasm = false;
+  bool round_trip = false;
+  SimArgs sim_args = { NULL, NULL, NULL, "idle", 1000000000, NULL, NULL, NULL, NULL, 0, 1, 0 };
+  
+  // an input that has not returned to idle after this many cycles hangs
+  sim_args.verify.samples = 2;
+  sim_args.verify.max_cycles = 10000;
+  int arg_pos = 1;
+  
+  while( arg_pos < argc && argv[arg_pos][0] == '-' )
+  {
+    if( strcmp( "-r", argv[arg_pos] ) == 0 )
+    {
+      binary_output = true;
+    }
+    else if( strcmp( "-O", argv[arg_pos] ) == 0 )
+    {
+      optimize = OPT_PEEPHOLE | OPT_JUMPS | OPT_TAILS;
+    }
+    else if( strcmp( "-Os", argv[arg_pos] ) == 0 )
+    {
+      optimize = OPT_PEEPHOLE | OPT_JUMPS | OPT_TAILS | OPT_SIZE;
+    }
+    else if( strcmp( "--depth", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      rom_depth = strtoul( argv[++arg_pos], NULL, 0 );
+    }
+    else if( strcmp( "--word-bits", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      word_bits = atoi( argv[++arg_pos] );
+    }
+    else if( strcmp( "--addr-bits", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      addr_bits = atoi( argv[++arg_pos] );
+    }
+    else if( strcmp( "--batch", argv[arg_pos] ) == 0 )
+    {
+      batch = true;
+    }
+    else if( strcmp( "--manifest", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      manifest = argv[++arg_pos];
+    }
+    else if( strcmp( "-j", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      threads = atoi( argv[++arg_pos] );
+    }
+    else if( strcmp( "--sim", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.program_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--mem", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.mem_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--mem-out", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.mem_out_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--fetch", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.fetch_label = argv[++arg_pos];
+    }
+    else if( strcmp( "--profile-out", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.profile_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--trace", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.trace_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--coverage", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.coverage_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--coverage-listing", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.coverage_listing_path = argv[++arg_pos];
+    }
+    else if( strcmp( "--profile-use", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      profile_use = argv[++arg_pos];
+    }
+    else if( strcmp( "--max-cycles", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.max_cycles = strtoull( argv[++arg_pos], NULL, 0 );
+      sim_args.verify.max_cycles = sim_args.max_cycles;
+    }
+    else if( strcmp( "--sweep", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.sweep_op = strtol( argv[++arg_pos], NULL, 0 ) & 0xf;
+    }
+    else if( strcmp( "--sweep-fills", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.sweep_fills = strtoul( argv[++arg_pos], NULL, 0 );
+    }
+    else if( strcmp( "--verify", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      sim_args.verify_op = strcmp( argv[arg_pos], "all" ) == 0 ? -1 : strtol( argv[arg_pos], NULL, 16 );
+    }
+    else if( strcmp( "--verify-samples", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.verify.samples = atoi( argv[++arg_pos] );
+    }
+    else if( strcmp( "--verify-exhaustive", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      sim_args.verify.exhaustive = true;
+      sim_args.verify.operands = strtoul( argv[++arg_pos], NULL, 16 ) & 0xfff;
+    }
+    else if( strcmp( "--listing", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      listing_file = fopen( argv[arg_pos], "w" );
+      if( listing_file == NULL )
+      {
+        printf("Unable to open listing file %s\n", argv[arg_pos]);
+        return 1;
+      }
+    }
+    else if( strcmp( "--cycles", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      cycles_file = fopen( argv[arg_pos], "w" );
+      if( cycles_file == NULL )
+      {
+        printf("Unable to open cycle report %s\n", argv[arg_pos]);
+        return 1;
+      }
+    }
+    else if( strcmp( "--layout", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      layout_file = fopen( argv[arg_pos], "w" );
+      if( layout_file == NULL )
+      {
+        printf("Unable to open layout report %s\n", argv[arg_pos]);
+        return 1;
+      }
+    }
+    else if( strcmp( "--symbols", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      // written when assembling, read by -d, so only opened once known
+      symbols_path = argv[++arg_pos];
+    }
+    else if( strcmp( "-d", argv[arg_pos] ) == 0 )
+    {
+      disasm = true;
+    }
+    else if( strcmp( "--round-trip", argv[arg_pos] ) == 0 )
+    {
+      disasm = true;
+      round_trip = true;
+    }
+    else if( strcmp( "--map-rom", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      map_file = fopen( argv[arg_pos], "wb" );
+      if( map_file == NULL )
+      {
+        printf("Unable to open mapping ROM %s\n", argv[arg_pos]);
+        return 1;
+      }
+    }
+    else if( strcmp( "--emit-c", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      arg_pos++;
+      c_file = fopen( argv[arg_pos], "w" );
+      if( c_file == NULL )
+      {
+        printf("Unable to open C file %s\n", argv[arg_pos]);
+        return 1;
+      }
+    }
+    else if( strcmp( "--c-name", argv[arg_pos] ) == 0 && arg_pos + 1 < argc )
+    {
+      c_name = argv[++arg_pos];
+    }
+    else
+    {
+      printf("Unknown option %s\n", argv[arg_pos]);
+      return 1;
+    }
+    arg_pos++;
+  }
+  
+  RomGeometry geom;
+  if( !init_geometry( &geom, rom_depth, word_bits, addr_bits ) )
+  {
+    printf("ROM geometry does not fit: depth %u in a %d bit word\n",
+           rom_depth, word_bits);
+    return 1;
+  }
+  
+  if( disasm )
+  {
+    return disassemble_images( argv + arg_pos, argc - arg_pos, &geom, binary_output,
+                               symbols_path, round_trip );
+  }
+  
+  if( batch || manifest != NULL )
+  {
+    if( listing_file != NULL || c_file != NULL || cycles_file != NULL || layout_file != NULL
+        || map_file != NULL || symbols_path != NULL || profile_use != NULL )
+    {
+      printf("--listing, --layout, --cycles, --map-rom, --symbols, --profile-use and --emit-c can only be used with a single srcfile\n");
+      return 1;
+    }
+    
+    // every remaining argument is a source file, written next to itself
+    int job_count = 0;
+    BatchJob* jobs = NULL;
+    if( manifest != NULL )
+    {
+      jobs = read_manifest( manifest, &job_count );
+      if( jobs == NULL )
+      {
+        printf("Unable to read manifest %s\n", manifest);
+        return 1;
+      }
+    }
+    else
+    {
+      job_count = argc - arg_pos;
+      jobs = calloc( job_count + 1, sizeof(BatchJob) );
+      int i;
+      for( i = 0; i < job_count; i++ )
+      {
+        const char* path = argv[arg_pos + i];
+        jobs[i].src_path = malloc( strlen( path ) + 1 );
+        strcpy( jobs[i].src_path, path );
+        jobs[i].out_path = default_out_path( path );
+      }
+    }
+    
+    if( threads <= 0 )
+    {
+      threads = default_thread_count();
+    }
+    
+    int failed = run_batch( jobs, job_count, threads, &geom, binary_output,
+                            optimize, sim_args.fetch_label );
+    
+    int i;
+    for( i = 0; i < job_count; i++ )
+    {
+      if( !jobs[i].ok )
+      {
+        printf("%s: %s\n", jobs[i].src_path, jobs[i].message);
+      }
+    }
+    free_jobs( jobs, job_count );
+    
+    return failed > 0 ? 1 : 0;
+  }
+  
+  if( symbols_path != NULL )
+  {
+    symbols_file = fopen( symbols_path, "wb" );
+    if( symbols_file == NULL )
+    {
+      printf("Unable to open symbol file %s\n", symbols_path);
+      return 1;
+    }
+  }
+  
+  const char* src_path = NULL;
+  if( arg_pos < argc )
+  {
+    src_path = argv[arg_pos];
+    src_file = fopen(argv[arg_pos], "r");
+    arg_pos++;
+  }
+  
+  if( arg_pos < argc )
+  {
+    out_file = fopen( argv[arg_pos], "wb" );
+  }
+  
+  // when simulating, translating or reporting, stdout is for the report
+  // and the image is only written if asked for
+  if( out_file == NULL && sim_args.program_path == NULL && c_file == NULL
+      && cycles_file == NULL && sim_args.sweep_op == 0 && sim_args.verify_op == 0 )
+  {
+    out_file =  stdout;
+  }
+  
+  if( src_file == NULL )
+  {
+    printf("Expected dda [options] srcfile [outfile]\n");
+    return 1;
+  }
+  
+  size_t src_len = 0;
+  char* src = load_source( src_file, &src_len );
+  fclose( src_file );
+  if( src == NULL )
+  {
+    printf("Unable to read srcfile\n");
+    return 1;
+  }
+  
+  LexState state = &(struct LexState){ 0 };
+  init_state( state, src, src_len, &geom );
+  state->optimize = optimize;
+  state->fetch_label = sim_args.fetch_label;
+  
+  if( profile_use != NULL )
+  {
+    size_t profile_len = 0;
+    char* profile = read_file( profile_use, &profile_len );
+    if( profile == NULL || !read_profile( state, profile, profile_len ) )
+    {
+      printf("Unable to read profile %s\n", profile_use);
+      free( profile );
+      return 1;
+    }
+    free( profile );
+    state->optimize |= OPT_PROFILE;
+  }
+  
+  if( !assemble( state ) )
+  {
+    printf("Error: %s @ line %d col %d \n",
+           state->error_msg, state->error_line, state->error_column);
+    return 1;
+  }
+  
+  // write the instructions (in the correct byte order)
+  // to the file
+  if( out_file != NULL )
+  {
+    bool written = binary_output ? write_binary( out_file, state )
+                                 : write_logisim( out_file, state );
+    fclose( out_file );
+    if( !written )
+    {
+      printf("Out of memory\n");
+      free_state( state );
+      free( src );
+      return 1;
+    }
+  }
+  
+  if( map_file != NULL )
+  {
+    write_opcode_map( map_file, binary_output, state );
+    fclose( map_file );
+  }
+  
+  if( listing_file != NULL )
+  {
+    write_listing( listing_file, state, NULL );
+    fclose( listing_file );
+  }
+  
+  if( layout_file != NULL )
+  {
+    write_layout_report( layout_file, state );
+    fclose( layout_file );
+  }
+  
+  if( symbols_file != NULL )
+  {
+    write_symbols( symbols_file, state, src_path );
+    fclose( symbols_file );
+  }
+  
+  if( cycles_file != NULL )
+  {
+    int fetch_addr = lookup_label( sim_args.fetch_label, state );
+    write_cycle_report( cycles_file, state, fetch_addr < 0 ? 0 : fetch_addr );
+    fclose( cycles_file );
+  }
+  
+  if( c_file != NULL )
+  {
+    int fetch_addr = lookup_label( sim_args.fetch_label, state );
+    write_c_translation( c_file, state->instructions, state->rom_used, &state->geom,
+                         fetch_addr < 0 ? 0 : fetch_addr, state->opcode_map, c_name );
+    fclose( c_file );
+  }
+  
+  int result = 0;
+  if( sim_args.program_path != NULL )
+  {
+    result = simulate( state, &sim_args );
+  }
+  if( sim_args.sweep_op != 0 )
+  {
+    result |= sweep( state, &sim_args );
+  }
+  if( sim_args.verify_op != 0 )
+  {
+    sim_args.verify.threads = threads > 0 ? threads : default_thread_count();
+    result |= verify( state, &sim_args );
+  }
+  
+  free_state( state );
+  free( src );
+  
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,1488 @@
+#include "assembler.h"
+
+/*
+* The peephole pass works on basic blocks of the parsed stream: runs of
+* micro operations inside one section that start at the section origin,
+* at a labelled instruction or after a jump, and end at a jump or the end
+* of the section.  Nothing is known on entry to a block, and at its exit
+* every register, memory and the flags are assumed live.
+*
+* Within a block, a forward pass numbers the value each register holds
+* so it can spot writes of a value that is already there and loads of a
+* memory word that is already in a register, which it turns into moves.
+* A backward pass then removes every micro operation whose flags are
+* overwritten by a later one and whose register and memory writes are
+* either redundant or overwritten before they are read.  The two repeat
+* until nothing changes.
+*
+* Sections are left as they are if removing words from them could move
+* something that is not reached through a label: the section holding the
+* idle word, any section that can run off its end into whatever follows,
+* any section that a jump to a plain address lands inside, and sections
+* that overlap, where a later .org decides which words survive.
+*/
+
+// values the forward pass knows about
+#define VN_ZERO   1
+#define VN_ONE    2
+#define VN_CONST  3     // + CONST_A..CONST_C
+#define VN_FIRST  8     // first value id handed out for unknowns
+
+#define BIT( r ) (1u << (r))
+
+// why a section is left alone
+#define FROZEN_LAYOUT   0x1 // its words must stay at their addresses
+#define FROZEN_SHADOWED 0x2 // overlaps another, so its words may not be
+                            // what ends up in the ROM
+
+typedef struct Peephole
+{
+  LexState state;
+  uint8_t* label_at;        // instruction starts a block
+  uint8_t* frozen;          // per section, FROZEN_*
+  uint8_t* redundant;       // per instruction, only changes the flags
+  uint32_t next_value;
+}
+Peephole;
+
+static bool is_jump( MicroInstruction w, LexState state )
+{
+  return (w & state->geom.mode) != 0;
+}
+
+/**
+* An unconditional jump, after which nothing falls through
+*/
+static bool is_goto( MicroInstruction w, LexState state )
+{
+  return is_jump( w, state ) && minstr_get( w, state->geom.cond ) == 0;
+}
+
+/**
+* Registers whose values a micro operation depends on
+*/
+static uint32_t reads( MicroInstruction w )
+{
+  int fs = minstr_get( w, M_FS );
+  bool rw = minstr_get( w, M_RW );
+  bool mw = minstr_get( w, M_MW );
+  bool load = rw && minstr_get( w, M_MF );
+  
+  bool uses_a = fs == F_A || fs >= F_ADD || mw || load;
+  bool uses_b = fs == F_B || fs == F_ADD || fs == F_SUB || fs == F_MUL || fs == F_DIV
+                || fs == F_AND || fs == F_OR || mw;
+  
+  uint32_t regs = 0;
+  if( uses_a )
+  {
+    regs |= BIT( minstr_get( w, M_AA ) );
+  }
+  if( uses_b && !minstr_get( w, M_MB ) )
+  {
+    regs |= BIT( minstr_get( w, M_BA ) );
+  }
+  return regs;
+}
+
+/**
+* Index of the next live instruction after i in the block, or end
+*/
+static uint32_t next_live( const Peephole* p, uint32_t i, uint32_t end )
+{
+  for( i++; i < end; i++ )
+  {
+    if( p->label_at[i] )
+    {
+      return end;
+    }
+    if( !(p->state->ir[i].flags & IR_DEAD) )
+    {
+      return i;
+    }
+  }
+  return end;
+}
+
+/**
+* Whether the flags set by instruction i are overwritten before anything
+* can look at them
+*/
+static bool flags_dead( const Peephole* p, uint32_t i, uint32_t end )
+{
+  uint32_t next = next_live( p, i, end );
+  return next < end && !is_jump( p->state->ir[next].word, p->state );
+}
+
+/**
+* Value numbering over one block: marks writes of a value a register
+* already holds, and turns repeated loads into moves.  Returns true if
+* an instruction was rewritten.
+*/
+static bool forward_block( Peephole* p, uint32_t begin, uint32_t end )
+{
+  LexState state = p->state;
+  uint32_t val[8];
+  uint32_t mem_addr[8];     // known memory words: address value -> value
+  uint32_t mem_val[8];
+  int mem_count = 0;
+  bool changed = false;
+  int r;
+  
+  for( r = 0; r < 8; r++ )
+  {
+    val[r] = p->next_value++;
+  }
+  
+  uint32_t i;
+  for( i = begin; i < end; i++ )
+  {
+    IrInstr* instr = &state->ir[i];
+    MicroInstruction w = instr->word;
+    p->redundant[i] = 0;
+    if( (instr->flags & IR_DEAD) || is_jump( w, state ) )
+    {
+      continue;
+    }
+    
+    int fs = minstr_get( w, M_FS );
+    int aa = minstr_get( w, M_AA );
+    int ba = minstr_get( w, M_BA );
+    int da = minstr_get( w, M_DA );
+    bool rw = minstr_get( w, M_RW );
+    bool mw = minstr_get( w, M_MW );
+    bool load = rw && minstr_get( w, M_MF );
+    
+    uint32_t b_val = val[ba];
+    if( minstr_get( w, M_MB ) )
+    {
+      b_val = ba >= CONST_A && ba <= CONST_C ? VN_CONST + ba : VN_ZERO;
+    }
+    
+    uint32_t f_val;
+    switch( fs )
+    {
+      case F_0:   f_val = VN_ZERO; break;
+      case F_1:   f_val = VN_ONE; break;
+      case F_A:
+      case F_MOV: f_val = val[aa]; break;
+      case F_B:   f_val = b_val; break;
+      default:    f_val = p->next_value++;
+    }
+    
+    uint32_t result = f_val;
+    if( load )
+    {
+      int m;
+      result = 0;
+      for( m = 0; m < mem_count; m++ )
+      {
+        if( mem_addr[m] == val[aa] )
+        {
+          result = mem_val[m];
+        }
+      }
+      
+      // already in a register: move it from there instead
+      int from = -1;
+      for( r = 0; r < 8 && result != 0; r++ )
+      {
+        if( val[r] == result )
+        {
+          from = r;
+          break;
+        }
+      }
+      if( from >= 0 && !mw && flags_dead( p, i, end ) )
+      {
+        MicroInstruction move = 0;
+        minstr_set( &move, M_RW, 1 );
+        minstr_set( &move, M_DA, da );
+        minstr_set( &move, M_FS, F_B );
+        minstr_set( &move, M_BA, from );
+        instr->word = move;
+        changed = true;
+      }
+      
+      if( result == 0 )
+      {
+        result = p->next_value++;
+        if( mem_count < 8 )
+        {
+          mem_addr[mem_count] = val[aa];
+          mem_val[mem_count] = result;
+          mem_count++;
+        }
+      }
+    }
+    
+    if( mw )
+    {
+      // any address could be the same word at run time
+      mem_addr[0] = val[aa];
+      mem_val[0] = b_val;
+      mem_count = 1;
+    }
+    
+    if( rw )
+    {
+      if( !mw && val[da] == result )
+      {
+        p->redundant[i] = 1;
+      }
+      val[da] = result;
+    }
+    else if( !mw )
+    {
+      // changes nothing but the flags
+      p->redundant[i] = 1;
+    }
+  }
+  
+  return changed;
+}
+
+/**
+* Liveness over one block, removing what is not needed.  Returns true if
+* an instruction was removed.
+*/
+static bool backward_block( Peephole* p, uint32_t begin, uint32_t end )
+{
+  LexState state = p->state;
+  uint32_t live = 0xff;
+  uint32_t stored = 0;      // address registers stored through later,
+                            // with no load in between
+  bool flags_live = true;
+  bool changed = false;
+  
+  uint32_t i;
+  for( i = end; i > begin; i-- )
+  {
+    IrInstr* instr = &state->ir[i - 1];
+    MicroInstruction w = instr->word;
+    if( instr->flags & IR_DEAD )
+    {
+      continue;
+    }
+    if( is_jump( w, state ) )
+    {
+      flags_live = true;
+      continue;
+    }
+    
+    int aa = minstr_get( w, M_AA );
+    int da = minstr_get( w, M_DA );
+    bool rw = minstr_get( w, M_RW );
+    bool mw = minstr_get( w, M_MW );
+    bool load = rw && minstr_get( w, M_MF );
+    
+    bool write_dead = !rw || !(live & BIT( da ));
+    bool store_dead = !mw || (stored & BIT( aa ));
+    if( !flags_live && (p->redundant[i - 1] || (write_dead && store_dead)) )
+    {
+      instr->flags |= IR_DEAD;
+      changed = true;
+      continue;
+    }
+    
+    if( rw )
+    {
+      live &= ~BIT( da );
+      stored &= ~BIT( da );
+    }
+    if( mw )
+    {
+      stored |= BIT( aa );
+    }
+    if( load )
+    {
+      stored = 0;
+    }
+    live |= reads( w );
+    flags_live = false;
+  }
+  
+  return changed;
+}
+
+/**
+* Works out which sections the passes have to leave alone.  frozen gets
+* FROZEN_* per section and raw_target marks, per address, the targets of
+* jumps to a plain address.  Returns the index + 1 of the idle word, or
+* 0 if there is no word at its address.
+*/
+static uint32_t freeze_sections( LexState state, uint8_t* frozen, uint8_t* raw_target )
+{
+  // the idle word: its label, or address 0 if it has none
+  const char* fetch_name = state->fetch_label != NULL ? state->fetch_label : "idle";
+  uint32_t fetch_instr = 0;
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    if( strcmp( state->labels.names + state->labels.labels[id].name, fetch_name ) == 0 )
+    {
+      fetch_instr = state->labels.labels[id].instr;
+    }
+  }
+  
+  uint32_t idle = fetch_instr;
+  
+  uint32_t i;
+  for( i = 0; i < state->ir_count; i++ )
+  {
+    MicroInstruction w = state->ir[i].word;
+    uint32_t target = minstr_get( w, state->geom.next_addr );
+    if( is_jump( w, state ) && state->ir[i].label == 0 && target < state->geom.depth )
+    {
+      raw_target[target] = 1;
+    }
+  }
+  
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    uint32_t end = section->first + section->count;
+    
+    if( fetch_instr == 0 ? section->origin == 0 && !section->relocatable
+                         : fetch_instr - 1 >= section->first && fetch_instr - 1 < end )
+    {
+      frozen[s] |= FROZEN_LAYOUT;
+      if( fetch_instr == 0 && section->count > 0 )
+      {
+        idle = section->first + 1;
+      }
+    }
+    
+    // a later .org writing over part of it decides what ends up there
+    uint32_t k;
+    for( k = s + 1; k < state->section_count; k++ )
+    {
+      IrSection* other = &state->sections[k];
+      if( section->count > 0 && other->count > 0
+          && !section->relocatable && !other->relocatable
+          && other->origin < section->origin + section->count
+          && section->origin < other->origin + other->count )
+      {
+        frozen[s] |= FROZEN_LAYOUT | FROZEN_SHADOWED;
+        frozen[k] |= FROZEN_LAYOUT | FROZEN_SHADOWED;
+      }
+    }
+    
+    // must end in an unconditional jump, or removing words would leave
+    // a gap of zero words to run into
+    if( section->count == 0 )
+    {
+      continue;
+    }
+    if( !is_goto( state->ir[end - 1].word, state ) )
+    {
+      frozen[s] |= FROZEN_LAYOUT;
+    }
+    
+    // jumps to plain addresses inside a section pin everything after it;
+    // a relocatable one has no address yet
+    uint32_t addr;
+    for( addr = section->origin + 1;
+         !section->relocatable && addr < section->origin + section->count; addr++ )
+    {
+      if( addr < state->geom.depth && raw_target[addr] )
+      {
+        frozen[s] |= FROZEN_LAYOUT;
+      }
+    }
+  }
+  
+  return idle;
+}
+
+void optimize_peephole( LexState state )
+{
+  Peephole p;
+  p.state = state;
+  p.label_at = calloc( state->ir_count + 1, 1 );
+  p.frozen = calloc( state->section_count + 1, 1 );
+  p.redundant = calloc( state->ir_count + 1, 1 );
+  p.next_value = VN_FIRST;
+  uint8_t* raw_target = calloc( state->geom.depth, 1 );
+  if( p.label_at == NULL || p.frozen == NULL || p.redundant == NULL || raw_target == NULL )
+  {
+    free( p.label_at );
+    free( p.frozen );
+    free( p.redundant );
+    free( raw_target );
+    error( "Out of memory", state );
+  }
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    if( state->labels.labels[id].instr != 0 )
+    {
+      p.label_at[state->labels.labels[id].instr - 1] = 1;
+    }
+  }
+  freeze_sections( state, p.frozen, raw_target );
+  free( raw_target );
+  
+  bool changed = true;
+  while( changed )
+  {
+    changed = false;
+    
+    uint32_t s;
+    for( s = 0; s < state->section_count; s++ )
+    {
+      IrSection* section = &state->sections[s];
+      uint32_t end = section->first + section->count;
+      if( p.frozen[s] )
+      {
+        continue;
+      }
+      
+      // split the section into blocks
+      uint32_t begin = section->first;
+      while( begin < end )
+      {
+        uint32_t block_end = begin + 1;
+        while( block_end < end && !p.label_at[block_end]
+               && !is_jump( state->ir[block_end - 1].word, state ) )
+        {
+          block_end++;
+        }
+        
+        changed |= forward_block( &p, begin, block_end );
+        changed |= backward_block( &p, begin, block_end );
+        begin = block_end;
+      }
+    }
+  }
+  
+  free( p.label_at );
+  free( p.frozen );
+  free( p.redundant );
+}
+
+/*
+* The jump pass works on whole sections.  It retargets jumps that land
+* on an unconditional jump to wherever that one goes, removes jumps to
+* the word that follows them anyway, and moves a block that can only be
+* jumped to (from a label after an unconditional jump up to the next
+* unconditional jump) behind an unconditional jump to it, which is then
+* removed.  A block only moves into another section if that section can
+* grow into unused addresses.  Words after an unconditional jump that no
+* remaining jump lands on before the next one are removed as unreachable.
+* With a profile, a block only moves behind the jump to it that runs most.
+*/
+
+typedef struct JumpPass
+{
+  LexState state;
+  uint8_t* frozen;          // per section, FROZEN_*
+  uint8_t* raw_target;      // per address, jumped to by number
+  uint8_t* targeted;        // per instruction, a label on it is jumped to
+  IrInstr* scratch;         // room to move instructions around
+  uint32_t idle;            // index + 1 of the idle word, or 0
+}
+JumpPass;
+
+#define NO_INSTR UINT32_MAX
+
+
+/**
+* Index of the section holding instruction i
+*/
+static uint32_t section_of( LexState state, uint32_t i )
+{
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    if( i >= section->first && i < section->first + section->count )
+    {
+      return s;
+    }
+  }
+  return state->section_count;
+}
+
+/**
+* The first live instruction a label resolves to, or NO_INSTR if it is
+* undefined or only followed by removed words in its section
+*/
+static uint32_t resolve( LexState state, uint32_t label )
+{
+  uint32_t instr = state->labels.labels[label].instr;
+  if( instr == 0 )
+  {
+    return NO_INSTR;
+  }
+  
+  IrSection* section = &state->sections[section_of( state, instr - 1 )];
+  uint32_t i;
+  for( i = instr - 1; i < section->first + section->count; i++ )
+  {
+    if( !(state->ir[i].flags & IR_DEAD) )
+    {
+      return i;
+    }
+  }
+  return NO_INSTR;
+}
+
+/**
+* Index of the live instruction before i in section s, or NO_INSTR
+*/
+static uint32_t prev_live( LexState state, uint32_t i, uint32_t s )
+{
+  while( i > state->sections[s].first )
+  {
+    i--;
+    if( !(state->ir[i].flags & IR_DEAD) )
+    {
+      return i;
+    }
+  }
+  return NO_INSTR;
+}
+
+/**
+* Points jumps that land on an unconditional jump at its target instead
+*/
+static bool thread_jumps( JumpPass* jp )
+{
+  LexState state = jp->state;
+  bool changed = false;
+  
+  uint32_t i;
+  for( i = 0; i < state->ir_count; i++ )
+  {
+    IrInstr* instr = &state->ir[i];
+    if( (instr->flags & IR_DEAD) || !is_jump( instr->word, state ) || instr->label == 0 )
+    {
+      continue;
+    }
+    
+    // follow the chain; one longer than the stream is a loop of jumps
+    uint32_t label = instr->label;
+    uint32_t addr = 0;
+    uint32_t hops;
+    for( hops = 0; hops <= state->ir_count && label != 0; hops++ )
+    {
+      uint32_t t = resolve( state, label - 1 );
+      if( t == NO_INSTR || t == i || t + 1 == jp->idle
+          || !is_goto( state->ir[t].word, state )
+          || (jp->frozen[section_of( state, t )] & FROZEN_SHADOWED)
+          || state->ir[t].label == label )
+      {
+        break;
+      }
+      label = state->ir[t].label;
+      addr = minstr_get( state->ir[t].word, state->geom.next_addr );
+    }
+    
+    if( hops == 0 || hops > state->ir_count )
+    {
+      continue;
+    }
+    instr->label = label;
+    if( label == 0 )
+    {
+      minstr_set( &instr->word, state->geom.next_addr, addr );
+    }
+    changed = true;
+  }
+  
+  return changed;
+}
+
+/**
+* Removes jumps to the instruction right after them
+*/
+static bool remove_fall_throughs( JumpPass* jp )
+{
+  LexState state = jp->state;
+  bool changed = false;
+  
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    uint32_t end = section->first + section->count;
+    if( jp->frozen[s] & FROZEN_LAYOUT )
+    {
+      continue;
+    }
+    
+    uint32_t i;
+    for( i = section->first; i < end; i++ )
+    {
+      IrInstr* instr = &state->ir[i];
+      if( (instr->flags & IR_DEAD) || !is_jump( instr->word, state ) || instr->label == 0 )
+      {
+        continue;
+      }
+      
+      uint32_t next = i + 1;
+      while( next < end && (state->ir[next].flags & IR_DEAD) )
+      {
+        next++;
+      }
+      if( next < end && resolve( state, instr->label - 1 ) == next )
+      {
+        instr->flags |= IR_DEAD;
+        changed = true;
+      }
+    }
+  }
+  
+  return changed;
+}
+
+/**
+* Moves the instructions [begin, end) of section from to position to of
+* section into, keeping labels and sections pointing at the same words
+*/
+static void move_block( JumpPass* jp, uint32_t begin, uint32_t end, uint32_t from,
+                        uint32_t to, uint32_t into )
+{
+  LexState state = jp->state;
+  uint32_t len = end - begin;
+  
+  // rotate [lo, hi) so that [mid, hi) comes first
+  uint32_t lo = to <= begin ? to : begin;
+  uint32_t mid = to <= begin ? begin : end;
+  uint32_t hi = to <= begin ? end : to;
+  memcpy( jp->scratch, state->ir + mid, (hi - mid) * sizeof(IrInstr) );
+  memcpy( jp->scratch + (hi - mid), state->ir + lo, (mid - lo) * sizeof(IrInstr) );
+  memcpy( state->ir + lo, jp->scratch, (hi - lo) * sizeof(IrInstr) );
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    uint32_t* instr = &state->labels.labels[id].instr;
+    if( *instr > lo && *instr <= mid )
+    {
+      *instr += hi - mid;
+    }
+    else if( *instr > mid && *instr <= hi )
+    {
+      *instr -= mid - lo;
+    }
+  }
+  
+  if( from == into )
+  {
+    return;
+  }
+  uint32_t s;
+  if( into < from )
+  {
+    for( s = into + 1; s <= from; s++ )
+    {
+      state->sections[s].first += len;
+    }
+  }
+  else
+  {
+    for( s = from + 1; s <= into; s++ )
+    {
+      state->sections[s].first -= len;
+    }
+  }
+  state->sections[from].count -= len;
+  state->sections[into].count += len;
+}
+
+/**
+* Live instructions in [begin, end)
+*/
+static uint32_t live_count( LexState state, uint32_t begin, uint32_t end )
+{
+  uint32_t count = 0;
+  for( ; begin < end; begin++ )
+  {
+    count += !(state->ir[begin].flags & IR_DEAD);
+  }
+  return count;
+}
+
+/**
+* Whether section s has room to grow by extra words without running
+* into another section or a word jumped to by number
+*/
+static bool can_grow( JumpPass* jp, uint32_t s, uint32_t extra )
+{
+  LexState state = jp->state;
+  IrSection* section = &state->sections[s];
+  if( section->relocatable )
+  {
+    // the layout finds it room later
+    return true;
+  }
+  uint32_t end = section->origin + live_count( state, section->first,
+                                               section->first + section->count );
+  if( end + extra > state->geom.depth )
+  {
+    return false;
+  }
+  
+  uint32_t k;
+  for( k = 0; k < state->section_count; k++ )
+  {
+    IrSection* other = &state->sections[k];
+    if( k != s && other->count > 0 && !other->relocatable && other->origin > section->origin
+        && other->origin < end + extra )
+    {
+      return false;
+    }
+  }
+  
+  uint32_t addr;
+  for( addr = end; addr < end + extra; addr++ )
+  {
+    if( jp->raw_target[addr] )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+* Jumps in the profile that putting the block t behind the unconditional
+* jump j saves: j itself, and a conditional jump to t right before it
+*/
+static uint64_t chain_gain( LexState state, uint32_t j, uint32_t t )
+{
+  uint64_t gain = state->ir[j].executed;
+  uint32_t prev = prev_live( state, j, section_of( state, j ) );
+  if( prev != NO_INSTR && is_jump( state->ir[prev].word, state ) && state->ir[prev].label != 0
+      && resolve( state, state->ir[prev].label - 1 ) == t )
+  {
+    gain += state->ir[prev].taken;
+  }
+  return gain;
+}
+
+/**
+* Whether the profile has another unconditional jump to t that would
+* gain more from the block than jump j
+*/
+static bool hotter_jump( const JumpPass* jp, uint32_t j, uint32_t t )
+{
+  LexState state = jp->state;
+  if( !(state->optimize & OPT_PROFILE) )
+  {
+    return false;
+  }
+  uint64_t gain = chain_gain( state, j, t );
+  uint32_t k;
+  for( k = 0; k < state->ir_count; k++ )
+  {
+    IrInstr* jump = &state->ir[k];
+    if( k != j && !(jump->flags & IR_DEAD) && is_goto( jump->word, state ) && jump->label != 0
+        && resolve( state, jump->label - 1 ) == t && chain_gain( state, k, t ) > gain )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* Moves blocks that are only jumped to behind the unconditional jump to
+* them, so that it can be removed; with a profile, behind the hottest
+*/
+static bool chain_blocks( JumpPass* jp )
+{
+  LexState state = jp->state;
+  bool changed = false;
+  
+  uint32_t j;
+  for( j = 0; j < state->ir_count; j++ )
+  {
+    IrInstr* jump = &state->ir[j];
+    if( (jump->flags & IR_DEAD) || !is_goto( jump->word, state ) || jump->label == 0 )
+    {
+      continue;
+    }
+    uint32_t into = section_of( state, j );
+    uint32_t t = resolve( state, jump->label - 1 );
+    if( (jp->frozen[into] & FROZEN_LAYOUT) || t == NO_INSTR )
+    {
+      continue;
+    }
+    uint32_t from = section_of( state, t );
+    IrSection* section = &state->sections[from];
+    if( jp->frozen[from] & FROZEN_LAYOUT )
+    {
+      continue;
+    }
+    
+    // the block takes the removed words before it along, and must not be
+    // the entry of a pinned section or something another word falls into
+    uint32_t begin = t;
+    while( begin > section->first && (state->ir[begin - 1].flags & IR_DEAD) )
+    {
+      begin--;
+    }
+    if( begin == section->first ? !section->relocatable
+                                : !is_goto( state->ir[begin - 1].word, state ) )
+    {
+      continue;
+    }
+    
+    uint32_t end = t;
+    while( end < section->first + section->count
+           && ((state->ir[end].flags & IR_DEAD) || !is_goto( state->ir[end].word, state )) )
+    {
+      end++;
+    }
+    if( end == section->first + section->count || (j >= begin && j <= end) )
+    {
+      continue;
+    }
+    end++;
+    
+    if( from != into && !can_grow( jp, into, live_count( state, begin, end ) - 1 ) )
+    {
+      continue;
+    }
+    if( hotter_jump( jp, j, t ) )
+    {
+      continue;
+    }
+    
+    jump->flags |= IR_DEAD;
+    move_block( jp, begin, end, from, j + 1, into );
+    changed = true;
+  }
+  
+  return changed;
+}
+
+/**
+* Removes the words between an unconditional jump and the next label
+* that a jump still goes to
+*/
+static bool remove_unreachable( JumpPass* jp )
+{
+  LexState state = jp->state;
+  bool changed = false;
+  
+  memset( jp->targeted, 0, state->ir_count );
+  uint32_t i;
+  for( i = 0; i < state->ir_count; i++ )
+  {
+    IrInstr* instr = &state->ir[i];
+    if( !(instr->flags & IR_DEAD) && is_jump( instr->word, state ) && instr->label != 0 )
+    {
+      uint32_t target = state->labels.labels[instr->label - 1].instr;
+      if( target != 0 )
+      {
+        jp->targeted[target - 1] = 1;
+      }
+    }
+  }
+  
+  // and the mapping ROM leads to every .opcode routine
+  uint32_t op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    uint32_t label = state->opcode_labels[op];
+    if( label != 0 && state->labels.labels[label - 1].instr != 0 )
+    {
+      jp->targeted[state->labels.labels[label - 1].instr - 1] = 1;
+    }
+  }
+  
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    if( jp->frozen[s] & FROZEN_LAYOUT )
+    {
+      continue;
+    }
+    
+    // only jumps lead into a relocatable section
+    bool reachable = !section->relocatable;
+    for( i = section->first; i < section->first + section->count; i++ )
+    {
+      IrInstr* instr = &state->ir[i];
+      reachable |= jp->targeted[i];
+      if( instr->flags & IR_DEAD )
+      {
+        continue;
+      }
+      if( !reachable )
+      {
+        instr->flags |= IR_DEAD;
+        changed = true;
+      }
+      else if( is_goto( instr->word, state ) )
+      {
+        reachable = false;
+      }
+    }
+  }
+  
+  return changed;
+}
+
+void optimize_jumps( LexState state )
+{
+  JumpPass jp;
+  jp.state = state;
+  jp.frozen = calloc( state->section_count + 1, 1 );
+  jp.raw_target = calloc( state->geom.depth, 1 );
+  jp.targeted = calloc( state->ir_count + 1, 1 );
+  jp.scratch = malloc( (state->ir_count + 1) * sizeof(IrInstr) );
+  if( jp.frozen == NULL || jp.raw_target == NULL || jp.targeted == NULL || jp.scratch == NULL )
+  {
+    free( jp.frozen );
+    free( jp.raw_target );
+    free( jp.targeted );
+    free( jp.scratch );
+    error( "Out of memory", state );
+  }
+  jp.idle = freeze_sections( state, jp.frozen, jp.raw_target );
+  
+  bool changed = true;
+  while( changed )
+  {
+    changed = thread_jumps( &jp );
+    changed |= remove_fall_throughs( &jp );
+    changed |= chain_blocks( &jp );
+    changed |= remove_unreachable( &jp );
+  }
+  
+  free( jp.frozen );
+  free( jp.raw_target );
+  free( jp.targeted );
+  free( jp.scratch );
+}
+
+/*
+* The tail pass shares identical code.  Two runs of words that end in
+* unconditional jumps to the same place and match word for word going
+* back from there do the same thing.  If one of them is a whole block
+* that can only be jumped to, the labels on it are moved to the other
+* copy and it is removed, which costs nothing.  With OPT_SIZE any common
+* tail of two words or more is shared as well: one copy is replaced by
+* a jump into the other, saving words at the cost of a cycle for the
+* routine that now jumps.  The jumps go to internal labels .tmN, which
+* no source label can clash with.
+*/
+
+typedef struct TailPass
+{
+  LexState state;
+  uint8_t* frozen;          // per section, FROZEN_*
+  uint32_t idle;            // index + 1 of the idle word, or 0
+  uint32_t* run_a;          // live instructions of the two runs compared,
+  uint32_t* run_b;          // from the jump backwards
+  uint8_t* kept;            // per jump, another run jumps into its run
+  uint32_t merged;          // internal labels made so far
+}
+TailPass;
+
+/**
+* Whether two jumps go to the same place
+*/
+static bool same_target( LexState state, const IrInstr* a, const IrInstr* b )
+{
+  if( a->label == 0 || b->label == 0 )
+  {
+    return a->label == b->label
+           && minstr_get( a->word, state->geom.next_addr )
+              == minstr_get( b->word, state->geom.next_addr );
+  }
+  uint32_t target = resolve( state, a->label - 1 );
+  return a->label == b->label
+         || (target != NO_INSTR && target == resolve( state, b->label - 1 ));
+}
+
+static bool same_instr( LexState state, const IrInstr* a, const IrInstr* b )
+{
+  if( !is_jump( a->word, state ) )
+  {
+    return a->word == b->word;
+  }
+  return (a->word & ~state->geom.next_addr) == (b->word & ~state->geom.next_addr)
+         && same_target( state, a, b );
+}
+
+/**
+* Matches the runs ending in the jumps a and b, filling run_a and run_b.
+* Returns their length; whole is set if b's run is a whole block that
+* nothing falls into.
+*/
+static uint32_t common_tail( TailPass* tp, uint32_t a, uint32_t b, bool* whole )
+{
+  LexState state = tp->state;
+  uint32_t section_a = section_of( state, a );
+  uint32_t section_b = section_of( state, b );
+  uint32_t len = 0;
+  
+  *whole = false;
+  while( a != b && a + 1 != tp->idle && b + 1 != tp->idle
+         && same_instr( state, &state->ir[a], &state->ir[b] ) )
+  {
+    tp->run_a[len] = a;
+    tp->run_b[len] = b;
+    len++;
+    
+    // going back past an unconditional jump leaves the run
+    a = prev_live( state, a, section_a );
+    b = prev_live( state, b, section_b );
+    if( b == NO_INSTR || is_goto( state->ir[b].word, state ) )
+    {
+      *whole = b != NO_INSTR || state->sections[section_b].relocatable;
+      break;
+    }
+    if( a == NO_INSTR || is_goto( state->ir[a].word, state ) )
+    {
+      break;
+    }
+  }
+  return len;
+}
+
+/**
+* Replaces b's run of len words with a's: labels that led into it lead
+* into a's copy, and it is removed or, unless whole, turned into a jump
+* to a's copy
+*/
+static void merge_tail( TailPass* tp, uint32_t len, bool whole )
+{
+  LexState state = tp->state;
+  uint32_t* run_a = tp->run_a;
+  uint32_t* run_b = tp->run_b;
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    Label* label = &state->labels.labels[id];
+    uint32_t target = resolve( state, id );
+    uint32_t m;
+    for( m = 0; m < len && target != NO_INSTR; m++ )
+    {
+      if( run_b[m] == target )
+      {
+        label->instr = run_a[m] + 1;
+        break;
+      }
+    }
+  }
+  
+  uint32_t m;
+  for( m = 0; m + 1 < len; m++ )
+  {
+    state->ir[run_b[m]].flags |= IR_DEAD;
+  }
+  
+  IrInstr* first = &state->ir[run_b[len - 1]];
+  if( whole )
+  {
+    first->flags |= IR_DEAD;
+    return;
+  }
+  
+  // an internal label at the start of a's copy
+  char name[16];
+  int name_len = sprintf( name, ".tm%u", tp->merged++ );
+  uint32_t hash = 2166136261u;
+  int i;
+  for( i = 0; i < name_len; i++ )
+  {
+    // same FNV-1a hash as read_symbol
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  uint32_t label = intern_label( name, name_len, hash, state );
+  state->labels.labels[label].instr = run_a[len - 1] + 1;
+  
+  // the jump takes the place of the first word, and shows up in the
+  // listing as the jump that ended the run
+  const IrInstr* last = &state->ir[run_b[0]];
+  first->word = 0;
+  minstr_set( &first->word, state->geom.mode, 1 );
+  first->label = label + 1;
+  first->src_offset = last->src_offset;
+  first->end_offset = last->end_offset;
+}
+
+bool optimize_tails( LexState state )
+{
+  TailPass tp;
+  tp.state = state;
+  tp.merged = 0;
+  tp.frozen = calloc( state->section_count + 1, 1 );
+  uint8_t* raw_target = calloc( state->geom.depth, 1 );
+  tp.run_a = malloc( (state->ir_count + 1) * sizeof(uint32_t) );
+  tp.run_b = malloc( (state->ir_count + 1) * sizeof(uint32_t) );
+  tp.kept = calloc( state->ir_count + 1, 1 );
+  if( tp.frozen == NULL || raw_target == NULL || tp.run_a == NULL || tp.run_b == NULL
+      || tp.kept == NULL )
+  {
+    free( tp.frozen );
+    free( raw_target );
+    free( tp.run_a );
+    free( tp.run_b );
+    free( tp.kept );
+    error( "Out of memory", state );
+  }
+  tp.idle = freeze_sections( state, tp.frozen, raw_target );
+  free( raw_target );
+  
+  uint32_t min_len = (state->optimize & OPT_SIZE) ? 2 : NO_INSTR;
+  bool any = false;
+  bool changed = true;
+  while( changed )
+  {
+    changed = false;
+    
+    // each jump ending a run that may be removed looks for the longest
+    // copy of its run elsewhere
+    uint32_t b;
+    for( b = 0; b < state->ir_count; b++ )
+    {
+      if( (state->ir[b].flags & IR_DEAD) || !is_goto( state->ir[b].word, state )
+          || (tp.frozen[section_of( state, b )] & FROZEN_LAYOUT) )
+      {
+        continue;
+      }
+      
+      uint32_t best = NO_INSTR;
+      uint32_t best_len = 0;
+      bool best_whole = false;
+      uint32_t a;
+      for( a = 0; a < state->ir_count; a++ )
+      {
+        if( (state->ir[a].flags & IR_DEAD) || !is_goto( state->ir[a].word, state )
+            || (tp.frozen[section_of( state, a )] & FROZEN_SHADOWED) )
+        {
+          continue;
+        }
+        bool whole;
+        uint32_t len = common_tail( &tp, a, b, &whole );
+        if( (whole && len > 0 && !best_whole) || (whole == best_whole && len > best_len) )
+        {
+          best = a;
+          best_len = len;
+          best_whole = whole;
+        }
+      }
+      
+      // a run others jump into stays, so no routine pays more than one
+      // extra jump
+      if( best == NO_INSTR || (!best_whole && (best_len < min_len || tp.kept[b])) )
+      {
+        continue;
+      }
+      bool whole;
+      common_tail( &tp, best, b, &whole );
+      merge_tail( &tp, best_len, best_whole );
+      tp.kept[best] |= !best_whole;
+      changed = true;
+      any = true;
+    }
+  }
+  
+  free( tp.frozen );
+  free( tp.run_a );
+  free( tp.run_b );
+  free( tp.kept );
+  return any;
+}
+
+/*
+* The profile pass lays out the code for the counts of a --profile-use
+* profile.  Every word takes a cycle whether a jump is taken or not, so
+* what it can save are the unconditional jumps on hot paths.  The counts
+* are given to each instruction by its source line and follow it from
+* there on, so later passes (chain_blocks) can use them too.
+*
+* The block an unconditional jump goes to is moved behind the hottest
+* jump to it from the same section, when that runs more often than the
+* word before the block falls into it.  The jump is removed and the word
+* that fell in gets a jump to the block instead, so the cold path pays
+* the cycle.  Then a conditional jump that is mostly not taken, with an
+* unconditional jump after it, is inverted: after any micro operation
+* exactly one of P, Z and N is set, so flipping all three CND bits and
+* swapping the two targets takes the hot path in one jump instead of two.
+*/
+
+/**
+* Times the live instruction i carries on to the word after it
+*/
+static uint64_t falls_through( LexState state, uint32_t i )
+{
+  const IrInstr* instr = &state->ir[i];
+  if( is_goto( instr->word, state ) )
+  {
+    return 0;
+  }
+  uint64_t taken = is_jump( instr->word, state ) ? instr->taken : 0;
+  return instr->executed > taken ? instr->executed - taken : 0;
+}
+
+/**
+* Whether a label leads to instruction i
+*/
+static bool is_entry( LexState state, uint32_t i )
+{
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    if( resolve( state, id ) == i )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+* Puts a jump to label at index at of section s, for the word before it
+* that falls through, moving everything after it along
+*/
+static void insert_jump( JumpPass* jp, uint32_t at, uint32_t s, uint32_t label )
+{
+  LexState state = jp->state;
+  IrInstr jump = state->ir[at - 1];
+  jump.word = 0;
+  minstr_set( &jump.word, state->geom.mode, 1 );
+  jump.label = label + 1;
+  jump.flags = 0;
+  jump.executed = falls_through( state, at - 1 );
+  jump.taken = jump.executed;
+  
+  if( state->ir_count == state->ir_capacity )
+  {
+    uint32_t capacity = state->ir_capacity * 2;
+    IrInstr* ir = realloc( state->ir, capacity * sizeof(IrInstr) );
+    if( ir == NULL )
+    {
+      error( "Out of memory", state );
+    }
+    state->ir = ir;
+    state->ir_capacity = capacity;
+  }
+  memmove( state->ir + at + 1, state->ir + at, (state->ir_count - at) * sizeof(IrInstr) );
+  state->ir[at] = jump;
+  state->ir_count++;
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    uint32_t* instr = &state->labels.labels[id].instr;
+    *instr += *instr > at;
+  }
+  state->sections[s].count++;
+  uint32_t k;
+  for( k = s + 1; k < state->section_count; k++ )
+  {
+    state->sections[k].first++;
+  }
+  jp->idle += jp->idle > at;
+}
+
+/**
+* Moves the block each label leads to behind its hottest unconditional
+* jump, if that beats falling into it
+*/
+static void place_hot_blocks( JumpPass* jp )
+{
+  LexState state = jp->state;
+  
+  uint32_t id;
+  for( id = 0; id < state->labels.count; id++ )
+  {
+    uint32_t t = resolve( state, id );
+    if( t == NO_INSTR || (state->ir[t].flags & IR_PLACED) )
+    {
+      continue;
+    }
+    state->ir[t].flags |= IR_PLACED;
+    uint32_t s = section_of( state, t );
+    IrSection* section = &state->sections[s];
+    if( jp->frozen[s] )
+    {
+      continue;
+    }
+    
+    // the block takes the removed words before it along, as in
+    // chain_blocks, and ends at the next unconditional jump
+    uint32_t begin = t;
+    while( begin > section->first && (state->ir[begin - 1].flags & IR_DEAD) )
+    {
+      begin--;
+    }
+    uint32_t end = t;
+    while( end < section->first + section->count
+           && ((state->ir[end].flags & IR_DEAD) || !is_goto( state->ir[end].word, state )) )
+    {
+      end++;
+    }
+    if( begin == section->first || end == section->first + section->count )
+    {
+      continue;
+    }
+    end++;
+    
+    uint32_t best = NO_INSTR;
+    uint64_t best_count = 0;
+    uint32_t j;
+    for( j = section->first; j < section->first + section->count; j++ )
+    {
+      IrInstr* jump = &state->ir[j];
+      if( (jump->flags & IR_DEAD) || !is_goto( jump->word, state ) || jump->label == 0
+          || (j >= begin && j < end) || j + 1 == jp->idle
+          || resolve( state, jump->label - 1 ) != t )
+      {
+        continue;
+      }
+      uint64_t count = chain_gain( state, j, t );
+      if( count > best_count )
+      {
+        best = j;
+        best_count = count;
+      }
+    }
+    
+    uint32_t prev = begin - 1;
+    if( best == NO_INSTR || best_count <= falls_through( state, prev ) )
+    {
+      continue;
+    }
+    
+    if( !is_goto( state->ir[prev].word, state ) )
+    {
+      best += best > begin;
+      insert_jump( jp, begin, s, id );
+      begin++;
+      end++;
+    }
+    state->ir[best].flags |= IR_DEAD;
+    move_block( jp, begin, end, s, best + 1, s );
+  }
+}
+
+/**
+* Inverts conditional jumps that are mostly not taken over the
+* unconditional jump after them
+*/
+static void invert_branches( JumpPass* jp )
+{
+  LexState state = jp->state;
+  const uint32_t all = COND_P | COND_Z | COND_N;
+  
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    IrSection* section = &state->sections[s];
+    if( jp->frozen[s] )
+    {
+      continue;
+    }
+    
+    uint32_t i;
+    for( i = section->first; i < section->first + section->count; i++ )
+    {
+      IrInstr* branch = &state->ir[i];
+      uint32_t cond = minstr_get( branch->word, state->geom.cond );
+      if( (branch->flags & IR_DEAD) || !is_jump( branch->word, state )
+          || cond == 0 || cond == all )
+      {
+        continue;
+      }
+      
+      // the flags must come from a micro operation, not the reset
+      uint32_t prev = prev_live( state, i, s );
+      uint32_t g = i + 1;
+      while( g < section->first + section->count && (state->ir[g].flags & IR_DEAD) )
+      {
+        g++;
+      }
+      if( prev == NO_INSTR || is_jump( state->ir[prev].word, state )
+          || g == section->first + section->count || !is_goto( state->ir[g].word, state )
+          || i + 1 == jp->idle || g + 1 == jp->idle
+          || is_entry( state, i ) || is_entry( state, g ) )
+      {
+        continue;
+      }
+      if( falls_through( state, i ) <= branch->taken )
+      {
+        continue;
+      }
+      
+      IrInstr* jump = &state->ir[g];
+      uint32_t label = branch->label;
+      uint32_t addr = minstr_get( branch->word, state->geom.next_addr );
+      minstr_set( &branch->word, state->geom.cond, cond ^ all );
+      minstr_set( &branch->word, state->geom.next_addr,
+                  minstr_get( jump->word, state->geom.next_addr ) );
+      branch->label = jump->label;
+      minstr_set( &jump->word, state->geom.next_addr, addr );
+      jump->label = label;
+      
+      // and so do the counts
+      branch->taken = branch->executed - branch->taken;
+      jump->executed = branch->executed - branch->taken;
+      jump->taken = jump->executed;
+    }
+  }
+}
+
+void optimize_profile( LexState state )
+{
+  if( state->profile_executed == NULL )
+  {
+    return;
+  }
+  
+  // the counts of the line each instruction came from
+  uint32_t line_count;
+  uint32_t* starts = line_starts( state, &line_count );
+  uint32_t i;
+  for( i = 0; i < state->ir_count; i++ )
+  {
+    IrInstr* instr = &state->ir[i];
+    uint32_t line = source_line( starts, line_count, instr->src_offset );
+    if( line < state->profile_lines )
+    {
+      instr->executed = state->profile_executed[line];
+      instr->taken = state->profile_taken[line];
+    }
+  }
+  free( starts );
+  
+  // every move can add a jump, and removes one
+  JumpPass jp;
+  jp.state = state;
+  jp.frozen = calloc( state->section_count + 1, 1 );
+  jp.raw_target = calloc( state->geom.depth, 1 );
+  jp.targeted = NULL;
+  jp.scratch = malloc( (2 * state->ir_count + 1) * sizeof(IrInstr) );
+  if( jp.frozen == NULL || jp.raw_target == NULL || jp.scratch == NULL )
+  {
+    free( jp.frozen );
+    free( jp.raw_target );
+    free( jp.scratch );
+    error( "Out of memory", state );
+  }
+  jp.idle = freeze_sections( state, jp.frozen, jp.raw_target );
+  
+  place_hot_blocks( &jp );
+  invert_branches( &jp );
+  
+  for( i = 0; i < state->ir_count; i++ )
+  {
+    state->ir[i].flags &= ~IR_PLACED;
+  }
+  
+  free( jp.frozen );
+  free( jp.raw_target );
+  free( jp.scratch );
+}
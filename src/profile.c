@@ -0,0 +1,292 @@
+#include "assembler.h"
+
+/*
+* Execution profiles.
+*
+* dda --sim --profile-out counts how often every ROM word ran and every
+* jump was taken, and writes one line per address that ran:
+*
+*   ; addr line executed taken
+*   0A 37 1200 800
+*
+* The source line is what ties a count to an instruction again when the
+* profile is read back for --profile-use, since the addresses move as
+* soon as the layout changes.  Lines starting with ; are comments.
+*
+* --coverage writes the same counts as a report, one record per line
+* tagged by its first field (word, line, fs or mem), so it can be read
+* with grep or awk, and --coverage-listing puts them next to the listing.
+*/
+
+// names of the F_* function unit codes, as in the listing
+static const char* FS_NAMES[16] = {
+  "0", "1", "A", "B", "ADD", "SUB", "MUL", "DIV",
+  "NOT", "AND", "OR", "NADD", "RSH", "LSH", "SAR", "MOV"
+};
+
+uint32_t* line_starts( LexState state, uint32_t* count )
+{
+  uint32_t n = 1;
+  const char* c;
+  for( c = state->src; c < state->src_end; c++ )
+  {
+    n += *c == '\n';
+  }
+  
+  uint32_t* starts = malloc( n * sizeof(uint32_t) );
+  if( starts == NULL )
+  {
+    error( "Out of memory", state );
+  }
+  starts[0] = 0;
+  n = 1;
+  for( c = state->src; c < state->src_end; c++ )
+  {
+    if( *c == '\n' )
+    {
+      starts[n++] = c + 1 - state->src;
+    }
+  }
+  *count = n;
+  return starts;
+}
+
+uint32_t source_line( const uint32_t* starts, uint32_t count, uint32_t offset )
+{
+  // the last line starting at or before offset
+  uint32_t lo = 0;
+  uint32_t hi = count;
+  while( hi - lo > 1 )
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if( starts[mid] <= offset )
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo + 1;
+}
+
+void write_profile( FILE* out_file, LexState state,
+                    const uint64_t* executed, const uint64_t* taken )
+{
+  uint32_t line_count;
+  uint32_t* starts = line_starts( state, &line_count );
+  int addr_digits = (state->geom.addr_bits + 3) / 4;
+  
+  fprintf( out_file, "; addr line executed taken\n" );
+  uint32_t addr;
+  for( addr = 0; addr < state->geom.depth; addr++ )
+  {
+    if( executed[addr] == 0 )
+    {
+      continue;
+    }
+    
+    // words past the image, or that no instruction wrote, have no line
+    uint32_t line = 0;
+    if( addr < state->rom_used && state->instr_src[addr] != 0 )
+    {
+      line = source_line( starts, line_count, state->instr_src[addr] - 1 );
+    }
+    fprintf( out_file, "%0*X %u %llu %llu\n", addr_digits, addr, line,
+             (unsigned long long)executed[addr], (unsigned long long)taken[addr] );
+  }
+  free( starts );
+}
+
+/**
+* Makes room for counts of lines up to line
+*/
+static bool grow_profile( LexState state, uint32_t line )
+{
+  if( line < state->profile_lines )
+  {
+    return true;
+  }
+  uint32_t lines = state->profile_lines == 0 ? 256 : state->profile_lines;
+  while( lines <= line )
+  {
+    lines *= 2;
+  }
+  
+  uint64_t* executed = realloc( state->profile_executed, lines * sizeof(uint64_t) );
+  if( executed == NULL )
+  {
+    return false;
+  }
+  state->profile_executed = executed;
+  uint64_t* taken = realloc( state->profile_taken, lines * sizeof(uint64_t) );
+  if( taken == NULL )
+  {
+    return false;
+  }
+  state->profile_taken = taken;
+  
+  uint32_t added = lines - state->profile_lines;
+  memset( executed + state->profile_lines, 0, added * sizeof(uint64_t) );
+  memset( taken + state->profile_lines, 0, added * sizeof(uint64_t) );
+  state->profile_lines = lines;
+  return true;
+}
+
+bool read_profile( LexState state, const char* text, size_t len )
+{
+  const char* c = text;
+  const char* end = text + len;
+  while( c < end )
+  {
+    const char* line_end = memchr( c, '\n', end - c );
+    if( line_end == NULL )
+    {
+      line_end = end;
+    }
+    
+    // address, line, executed, taken
+    unsigned long long fields[4];
+    int field_count = 0;
+    while( c < line_end && *c != ';' )
+    {
+      if( isspace( (unsigned char)*c ) )
+      {
+        c++;
+        continue;
+      }
+      char* field_end;
+      unsigned long long value = strtoull( c, &field_end, field_count == 0 ? 16 : 10 );
+      if( field_end == c || field_end > line_end || field_count == 4 )
+      {
+        return false;
+      }
+      fields[field_count++] = value;
+      c = field_end;
+    }
+    c = line_end + 1;
+    
+    if( field_count == 0 )
+    {
+      continue;
+    }
+    if( field_count != 4 || fields[1] > UINT32_MAX - 1 )
+    {
+      return false;
+    }
+    
+    // several addresses can come from one line, once merged or copied
+    uint32_t line = (uint32_t)fields[1];
+    if( line == 0 )
+    {
+      continue;
+    }
+    if( !grow_profile( state, line ) )
+    {
+      return false;
+    }
+    state->profile_executed[line] += fields[2];
+    state->profile_taken[line] += fields[3];
+  }
+  return true;
+}
+
+void write_coverage( FILE* out_file, LexState state,
+                     const uint64_t* executed, const uint64_t* taken )
+{
+  uint32_t line_count;
+  uint32_t* starts = line_starts( state, &line_count );
+  uint64_t* line_executed = calloc( line_count + 1, sizeof(uint64_t) );
+  uint32_t* line_words = calloc( line_count + 1, sizeof(uint32_t) );
+  if( line_executed == NULL || line_words == NULL )
+  {
+    free( starts );
+    free( line_executed );
+    free( line_words );
+    error( "Out of memory", state );
+  }
+  int addr_digits = (state->geom.addr_bits + 3) / 4;
+  
+  uint64_t cycles = 0;
+  uint32_t words = 0;
+  uint32_t words_run = 0;
+  uint32_t addr;
+  for( addr = 0; addr < state->geom.depth; addr++ )
+  {
+    cycles += executed[addr];
+    if( addr < state->rom_used && state->instr_src[addr] != 0 )
+    {
+      words++;
+      words_run += executed[addr] != 0;
+    }
+  }
+  fprintf( out_file, "; %llu cycles, %u of %u words executed\n",
+           (unsigned long long)cycles, words_run, words );
+  
+  // every assembled word, so the ones that never ran show up as 0
+  uint64_t fs_executed[16] = { 0 };
+  uint64_t mem_reads = 0;
+  uint64_t mem_writes = 0;
+  fprintf( out_file, "; word addr line executed taken\n" );
+  for( addr = 0; addr < state->geom.depth; addr++ )
+  {
+    bool assembled = addr < state->rom_used && state->instr_src[addr] != 0;
+    if( !assembled && executed[addr] == 0 )
+    {
+      continue;
+    }
+    uint32_t line = 0;
+    if( assembled )
+    {
+      line = source_line( starts, line_count, state->instr_src[addr] - 1 );
+      line_executed[line] += executed[addr];
+      line_words[line]++;
+    }
+    fprintf( out_file, "word %0*X %u %llu %llu\n", addr_digits, addr, line,
+             (unsigned long long)executed[addr], (unsigned long long)taken[addr] );
+    
+    // words past the image run as 0, a micro operation that writes nothing
+    MicroInstruction minstr = addr < state->rom_used ? state->instructions[addr] : 0;
+    if( minstr_get( minstr, state->geom.mode ) == 0 )
+    {
+      fs_executed[minstr_get( minstr, M_FS )] += executed[addr];
+      if( minstr_get( minstr, M_RW ) && minstr_get( minstr, M_MF ) )
+      {
+        mem_reads += executed[addr];
+      }
+      if( minstr_get( minstr, M_MW ) )
+      {
+        mem_writes += executed[addr];
+      }
+    }
+  }
+  
+  fprintf( out_file, "; line number words executed\n" );
+  uint32_t line;
+  for( line = 1; line <= line_count; line++ )
+  {
+    if( line_words[line] != 0 )
+    {
+      fprintf( out_file, "line %u %u %llu\n", line, line_words[line],
+               (unsigned long long)line_executed[line] );
+    }
+  }
+  
+  // jumps leave the function unit idle, so they are not counted here
+  fprintf( out_file, "; fs code name executed\n" );
+  int fs;
+  for( fs = 0; fs < 16; fs++ )
+  {
+    fprintf( out_file, "fs %X %s %llu\n", fs, FS_NAMES[fs],
+             (unsigned long long)fs_executed[fs] );
+  }
+  
+  fprintf( out_file, "; mem access count\n" );
+  fprintf( out_file, "mem read %llu\n", (unsigned long long)mem_reads );
+  fprintf( out_file, "mem write %llu\n", (unsigned long long)mem_writes );
+  
+  free( starts );
+  free( line_executed );
+  free( line_words );
+}
@@ -0,0 +1,607 @@
+#include "sim.h"
+#include "trace.h"
+
+// micro operation fields, see the M_* masks in assembler.h
+#define W_AA(w) (((w) >> 13) & 0x7)
+#define W_BA(w) (((w) >> 9) & 0x7)
+#define W_FS(w) (((w) >> 4) & 0xf)
+#define W_DA(w) (((w) >> 1) & 0x7)
+
+bool sim_init( DdSim* sim, const MicroInstruction* rom, uint32_t rom_len,
+               const RomGeometry* geom, uint32_t fetch_addr,
+               const uint32_t* dispatch )
+{
+  memset( sim, 0, sizeof(DdSim) );
+  sim->geom = *geom;
+  sim->fetch_addr = fetch_addr;
+  sim->upc = fetch_addr;
+  
+  // an entry past the end of the control store lands on address 0
+  uint32_t op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    uint32_t entry = dispatch != NULL ? dispatch[op] : op << OPCODE_SLOT_BITS;
+    sim->dispatch[op] = entry < geom->depth ? entry : 0;
+  }
+  
+  // addresses past the end of the assembled image are zero (nop)
+  sim->rom = calloc( geom->depth, sizeof(MicroInstruction) );
+  sim->ops = malloc( geom->depth * sizeof(SimOp) );
+  sim->mem = calloc( SIM_MEM_WORDS, sizeof(uint16_t) );
+  if( sim->rom == NULL || sim->ops == NULL || sim->mem == NULL )
+  {
+    sim_free( sim );
+    return false;
+  }
+  if( rom_len > geom->depth )
+  {
+    rom_len = geom->depth;
+  }
+  memcpy( sim->rom, rom, rom_len * sizeof(MicroInstruction) );
+  
+  sim_decode( sim );
+  return true;
+}
+
+void sim_decode( DdSim* sim )
+{
+  const uint32_t depth = sim->geom.depth;
+  const int cond_shift = 4 + sim->geom.addr_bits;
+  const uint32_t addr_mask = ((uint64_t)1 << sim->geom.addr_bits) - 1;
+  
+  uint32_t addr;
+  for( addr = 0; addr < depth; addr++ )
+  {
+    MicroInstruction w = sim->rom[addr];
+    SimOp* op = &sim->ops[addr];
+    memset( op, 0, sizeof(SimOp) );
+    op->word = w;
+    op->next = &sim->ops[addr + 1 < depth ? addr + 1 : 0];
+    
+    if( w & sim->geom.mode )
+    {
+      uint32_t target = (w >> 4) & addr_mask;
+      op->cond = (w >> cond_shift) & 0x7;
+      op->kind = op->cond == 0 ? SIM_K_JUMP : SIM_K_BRANCH;
+      op->target = &sim->ops[target < depth ? target : 0];
+    }
+    else
+    {
+      bool rw = (w & M_RW) != 0;
+      bool mw = (w & M_MW) != 0;
+      bool load = rw && (w & M_MF);
+      
+      op->a = W_AA( w );
+      op->b = (w & M_MB) ? SIM_FILE_CONSTS + W_BA( w ) : W_BA( w );
+      op->d = rw ? W_DA( w ) : SIM_FILE_SINK;
+      op->fs = W_FS( w );
+      
+      if( load && mw )
+      {
+        op->kind = SIM_K_LOAD_STORE;
+      }
+      else if( load )
+      {
+        op->kind = SIM_K_LOAD;
+      }
+      else if( mw )
+      {
+        op->kind = SIM_K_STORE;
+      }
+      else
+      {
+        op->kind = SIM_K_ALU + op->fs;
+      }
+    }
+    
+    if( addr == sim->fetch_addr )
+    {
+      op->kind = SIM_K_FETCH;
+    }
+  }
+}
+
+void sim_free( DdSim* sim )
+{
+  free( sim->rom );
+  free( sim->ops );
+  free( sim->mem );
+  sim->rom = NULL;
+  sim->ops = NULL;
+  sim->mem = NULL;
+}
+
+void sim_load_program( DdSim* sim, const uint16_t* program, uint32_t len )
+{
+  sim->program = program;
+  sim->program_len = len;
+  sim->pc = 0;
+  sim->status = SIM_RUNNING;
+}
+
+uint16_t sim_function( int fs, uint16_t a, uint16_t b )
+{
+  switch( fs )
+  {
+    case F_0:    return 0;
+    case F_1:    return 1;
+    case F_A:    return a;
+    case F_B:    return b;
+    case F_ADD:  return a + b;
+    case F_SUB:  return a - b;
+    case F_MUL:  return a * b;
+    case F_DIV:  return b == 0 ? 0xffff : a / b;  // no trap, all ones
+    case F_NOT:  return ~a;
+    case F_AND:  return a & b;
+    case F_OR:   return a | b;
+    case F_NADD: return -a;
+    case F_RSH:  return a >> 1;
+    case F_LSH:  return a << 1;
+    case F_SAR:  return (a >> 1) | (a & 0x8000);
+    case F_MOV:  return a;
+  }
+  return 0;
+}
+
+/**
+* PZN flags of a function unit result
+*/
+static uint8_t result_flags( uint16_t f )
+{
+  if( f == 0 )
+  {
+    return COND_Z;
+  }
+  return (f & 0x8000) ? COND_N : COND_P;
+}
+
+/**
+* Loads the next macro instruction into IR and constIn and returns its
+* slot, or sets the status and returns NULL if there isn't one to run
+*/
+static SimOp* sim_fetch( DdSim* sim, uint16_t* file )
+{
+  if( sim->pc >= sim->program_len )
+  {
+    sim->status = SIM_END;
+    return NULL;
+  }
+  
+  uint16_t ir = sim->program[sim->pc++];
+  if( IR_OP( ir ) == 0 )
+  {
+    sim->status = SIM_HALT;
+    return NULL;
+  }
+  
+  sim->ir = ir;
+  file[SIM_FILE_CONSTS + CONST_A] = IR_A( ir );
+  file[SIM_FILE_CONSTS + CONST_B] = IR_B( ir );
+  file[SIM_FILE_CONSTS + CONST_C] = IR_C( ir );
+  sim->instructions++;
+  
+  return &sim->ops[sim->dispatch[IR_OP( ir )]];
+}
+
+/**
+* Executes any micro operation the slow way, returns the new flags
+*/
+static uint8_t sim_execute( const SimOp* op, uint16_t* file, uint16_t* mem )
+{
+  uint16_t a = file[op->a];
+  uint16_t b = file[op->b];
+  uint16_t f = sim_function( op->fs, a, b );
+  uint16_t data = mem[a];
+  if( op->word & M_MW )
+  {
+    mem[a] = b;
+  }
+  file[op->d] = (op->word & M_MF) ? data : f;
+  return result_flags( f );
+}
+
+/*
+* Ops are executed with threaded dispatch: each handler jumps straight
+* to the handler of the next op.  With GCC and clang that uses computed
+* goto; otherwise it falls back to a switch in a loop.
+*/
+#if defined(__GNUC__)
+#define SIM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+#ifdef SIM_THREADED
+#define HANDLER( k )  L_##k
+#define DISPATCH()    do { if( --budget == 0 ) goto done; goto *handlers[op->kind]; } while( 0 )
+#else
+#define HANDLER( k )  case k
+#define DISPATCH()    do { if( --budget == 0 ) goto done; goto next; } while( 0 )
+#endif
+
+#define FLAGS( f ) ((f) == 0 ? COND_Z : ((f) & 0x8000) ? COND_N : COND_P)
+
+#define ALU( fs, expr ) \
+  HANDLER( fs ): \
+  { \
+    uint16_t a = file[op->a]; \
+    uint16_t b = file[op->b]; \
+    uint16_t f = (expr); \
+    (void)a; (void)b; \
+    file[op->d] = f; \
+    flags = FLAGS( f ); \
+    op = op->next; \
+    DISPATCH(); \
+  }
+
+int sim_run( DdSim* sim, uint64_t max_cycles )
+{
+  // registers, constIn and the sink in one array so ops can index it
+  uint16_t file[SIM_FILE_SIZE];
+  memcpy( file, sim->regs, sizeof(sim->regs) );
+  memcpy( file + SIM_FILE_CONSTS, sim->consts, sizeof(sim->consts) );
+  file[SIM_FILE_SINK] = 0;
+  
+  uint16_t* mem = sim->mem;
+  uint8_t flags = sim->flags;
+  SimOp* op = &sim->ops[sim->upc];
+  
+  // handlers run until the budget is used up; one more than the cycles
+  // so the check can be a decrement before each dispatch
+  uint64_t budget = max_cycles + 1;
+  
+  sim->status = SIM_RUNNING;
+
+#ifdef SIM_THREADED
+  static const void* const handlers[SIM_K_COUNT] = {
+    &&L_0,  &&L_1,  &&L_2,  &&L_3,  &&L_4,  &&L_5,  &&L_6,  &&L_7,
+    &&L_8,  &&L_9,  &&L_10, &&L_11, &&L_12, &&L_13, &&L_14, &&L_15,
+    &&L_16, &&L_17, &&L_18, &&L_19, &&L_20, &&L_21
+  };
+  DISPATCH();
+#else
+  if( --budget == 0 )
+  {
+    goto done;
+  }
+next:
+  switch( op->kind )
+  {
+#endif
+  
+  ALU( 0,  0 )
+  ALU( 1,  1 )
+  ALU( 2,  a )
+  ALU( 3,  b )
+  ALU( 4,  a + b )
+  ALU( 5,  a - b )
+  ALU( 6,  a * b )
+  ALU( 7,  b == 0 ? 0xffff : a / b )
+  ALU( 8,  ~a )
+  ALU( 9,  a & b )
+  ALU( 10, a | b )
+  ALU( 11, -a )
+  ALU( 12, a >> 1 )
+  ALU( 13, a << 1 )
+  ALU( 14, (a >> 1) | (a & 0x8000) )
+  ALU( 15, a )
+  
+  HANDLER( 16 ):  // SIM_K_LOAD
+  {
+    uint16_t a = file[op->a];
+    uint16_t f = sim_function( op->fs, a, file[op->b] );
+    file[op->d] = mem[a];
+    flags = FLAGS( f );
+    op = op->next;
+    DISPATCH();
+  }
+  
+  HANDLER( 17 ):  // SIM_K_STORE
+  {
+    uint16_t a = file[op->a];
+    uint16_t b = file[op->b];
+    uint16_t f = sim_function( op->fs, a, b );
+    mem[a] = b;
+    file[op->d] = f;
+    flags = FLAGS( f );
+    op = op->next;
+    DISPATCH();
+  }
+  
+  HANDLER( 18 ):  // SIM_K_LOAD_STORE
+  {
+    flags = sim_execute( op, file, mem );
+    op = op->next;
+    DISPATCH();
+  }
+  
+  HANDLER( 19 ):  // SIM_K_JUMP
+  {
+    op = op->target;
+    DISPATCH();
+  }
+  
+  HANDLER( 20 ):  // SIM_K_BRANCH
+  {
+    op = (op->cond & flags) ? op->target : op->next;
+    DISPATCH();
+  }
+  
+  HANDLER( 21 ):  // SIM_K_FETCH
+  {
+    if( op->word & sim->geom.mode )
+    {
+      uint32_t cond = op->cond;
+      op = (cond == 0 || (cond & flags)) ? op->target : op->next;
+    }
+    else
+    {
+      flags = sim_execute( op, file, mem );
+    }
+    
+    SimOp* slot = sim_fetch( sim, file );
+    if( slot == NULL )
+    {
+      goto done;
+    }
+    op = slot;
+    DISPATCH();
+  }
+
+#ifndef SIM_THREADED
+  }
+#endif
+
+done:
+  ;
+  // every dispatch used one unit of budget, apart from the one that
+  // found it exhausted
+  uint64_t executed = max_cycles + 1 - budget;
+  if( sim->status == SIM_RUNNING )
+  {
+    sim->status = SIM_CYCLE_LIMIT;
+    executed--;
+  }
+  
+  memcpy( sim->regs, file, sizeof(sim->regs) );
+  memcpy( sim->consts, file + SIM_FILE_CONSTS, sizeof(sim->consts) );
+  sim->flags = flags;
+  sim->upc = op - sim->ops;
+  sim->cycles += executed;
+  return sim->status;
+}
+
+#undef ALU
+#undef FLAGS
+#undef DISPATCH
+#undef HANDLER
+
+int sim_run_profiled( DdSim* sim, uint64_t max_cycles,
+                      uint64_t* executed, uint64_t* taken )
+{
+  uint16_t file[SIM_FILE_SIZE];
+  memcpy( file, sim->regs, sizeof(sim->regs) );
+  memcpy( file + SIM_FILE_CONSTS, sim->consts, sizeof(sim->consts) );
+  file[SIM_FILE_SINK] = 0;
+  
+  uint8_t flags = sim->flags;
+  SimOp* op = &sim->ops[sim->upc];
+  uint64_t cycles = 0;
+  
+  sim->status = SIM_RUNNING;
+  while( cycles < max_cycles )
+  {
+    uint32_t addr = op - sim->ops;
+    SimOp* next = op->next;
+    executed[addr]++;
+    cycles++;
+    
+    if( op->word & sim->geom.mode )
+    {
+      if( op->cond == 0 || (op->cond & flags) )
+      {
+        taken[addr]++;
+        next = op->target;
+      }
+    }
+    else
+    {
+      flags = sim_execute( op, file, sim->mem );
+    }
+    
+    if( op->kind == SIM_K_FETCH )
+    {
+      next = sim_fetch( sim, file );
+      if( next == NULL )
+      {
+        break;
+      }
+    }
+    op = next;
+  }
+  if( sim->status == SIM_RUNNING )
+  {
+    sim->status = SIM_CYCLE_LIMIT;
+  }
+  
+  memcpy( sim->regs, file, sizeof(sim->regs) );
+  memcpy( sim->consts, file + SIM_FILE_CONSTS, sizeof(sim->consts) );
+  sim->flags = flags;
+  sim->upc = op - sim->ops;
+  sim->cycles += cycles;
+  return sim->status;
+}
+
+int sim_run_traced( DdSim* sim, uint64_t max_cycles, TraceWriter* trace )
+{
+  uint16_t file[SIM_FILE_SIZE];
+  memcpy( file, sim->regs, sizeof(sim->regs) );
+  memcpy( file + SIM_FILE_CONSTS, sim->consts, sizeof(sim->consts) );
+  file[SIM_FILE_SINK] = 0;
+  
+  uint8_t flags = sim->flags;
+  SimOp* op = &sim->ops[sim->upc];
+  uint64_t cycles = 0;
+  
+  sim->status = SIM_RUNNING;
+  while( cycles < max_cycles )
+  {
+    if( trace->cycles % TRACE_INTERVAL == 0
+        && !trace_keyframe( trace, file, flags, op - sim->ops, sim->ir, sim->pc ) )
+    {
+      trace->failed = true;
+      break;
+    }
+    
+    SimOp* next = op->next;
+    cycles++;
+    trace->cycles++;
+    
+    if( op->word & sim->geom.mode )
+    {
+      bool taken = op->cond == 0 || (op->cond & flags);
+      next = taken ? op->target : next;
+      trace_put( trace, TRACE_JUMP_RECORD( taken, next - sim->ops ) );
+    }
+    else
+    {
+      // the memory write is replayed from the registers before the cycle
+      bool rw = op->d < SIM_REGS;
+      flags = sim_execute( op, file, sim->mem );
+      uint16_t value = rw ? file[op->d] : 0;
+      uint8_t d = rw ? op->d : 0;
+      if( op->word & M_MW )
+      {
+        trace_put( trace, TRACE_STORE_RECORD( flags, rw, d, value, op->a, op->b ) );
+      }
+      else
+      {
+        trace_put( trace, TRACE_OP_RECORD( flags, rw, d, value ) );
+      }
+    }
+    
+    if( op->kind == SIM_K_FETCH )
+    {
+      next = sim_fetch( sim, file );
+      if( next == NULL )
+      {
+        break;
+      }
+      trace_put( trace, TRACE_FETCH_RECORD( sim->ir ) );
+    }
+    op = next;
+  }
+  if( sim->status == SIM_RUNNING )
+  {
+    sim->status = SIM_CYCLE_LIMIT;
+  }
+  
+  memcpy( sim->regs, file, sizeof(sim->regs) );
+  memcpy( sim->consts, file + SIM_FILE_CONSTS, sizeof(sim->consts) );
+  sim->flags = flags;
+  sim->upc = op - sim->ops;
+  sim->cycles += cycles;
+  return sim->status;
+}
+
+#ifdef SIM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+static int hex_value( int c )
+{
+  if( c >= '0' && c <= '9' ) return c - '0';
+  if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+  if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+  return -1;
+}
+
+bool read_word_image( const char* text, size_t len,
+                      uint16_t* words, uint32_t capacity, uint32_t* count )
+{
+  const char* c = text;
+  const char* end = text + len;
+  
+  // optional header line
+  static const char header[] = "v2.0 raw";
+  if( len >= sizeof(header) - 1 && memcmp( text, header, sizeof(header) - 1 ) == 0 )
+  {
+    c += sizeof(header) - 1;
+  }
+  
+  uint32_t n = 0;
+  while( true )
+  {
+    while( c < end && isspace( (unsigned char)*c ) )
+    {
+      c++;
+    }
+    if( c >= end )
+    {
+      break;
+    }
+    
+    // value, or repeat count followed by '*' and the value
+    uint32_t value = 0;
+    uint32_t repeat = 1;
+    int digits = 0;
+    while( c < end && hex_value( *c ) >= 0 )
+    {
+      value = value * 16 + hex_value( *c++ );
+      digits++;
+    }
+    if( c < end && *c == '*' )
+    {
+      // Logisim writes the run length in decimal
+      const char* d;
+      repeat = 0;
+      for( d = c - digits; d < c; d++ )
+      {
+        if( *d < '0' || *d > '9' )
+        {
+          return false;
+        }
+        repeat = repeat * 10 + (*d - '0');
+      }
+      c++;
+      value = 0;
+      digits = 0;
+      while( c < end && hex_value( *c ) >= 0 )
+      {
+        value = value * 16 + hex_value( *c++ );
+        digits++;
+      }
+    }
+    
+    if( digits == 0 || digits > 4 || (c < end && !isspace( (unsigned char)*c )) )
+    {
+      return false;
+    }
+    if( repeat > capacity - n )
+    {
+      return false;
+    }
+    while( repeat-- > 0 )
+    {
+      words[n++] = (uint16_t)value;
+    }
+  }
+
+  *count = n;
+  return true;
+}
+
+void write_word_image( FILE* out_file, const uint16_t* words, uint32_t count )
+{
+  while( count > 0 && words[count - 1] == 0 )
+  {
+    count--;
+  }
+  
+  fprintf( out_file, "v2.0 raw\x0A" );
+  uint32_t i;
+  for( i = 0; i < count; i++ )
+  {
+    fprintf( out_file, i % 16 == 15 || i + 1 == count ? "%04x\x0A" : "%04x ", words[i] );
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "assembler.h"
+
+/**
+* DDmini simulator
+*
+* Executes an assembled control store directly, one ROM word per
+* microcycle, against the data path described in assembler.h:
+  
+  A bus    R[AA]
+  B bus    MB=0: R[BA]
+           MB=1: constIn selected by BA (0, A, B or C of the current
+                 macro instruction, anything else is 0)
+  F        function unit output for FS over the A and B buses
+  memory   address is the A bus, data out is the B bus
+           MW=1: M[A] <- B
+  register RW=1: R[DA] <- MF ? M[A] : F   (memory is read before MW writes)
+
+* Every micro operation latches the PZN flags from F (F is signed: P if
+* F > 0, Z if F = 0, N if F < 0).  A loaded memory value does not set the
+* flags, which is why micro.asm moves it through the function unit
+* (mov r2 r2) before testing it.
+*
+* A microsequencing word jumps to NXT_ADDR when CND is 0 or any of its
+* P/Z/N bits is set in the flags, and falls through otherwise.
+*
+* Macro instructions are fetched from a separate program memory.  Each
+* time the word at the fetch address (the idle loop) has executed, the
+* next macro instruction is loaded into IR and control dispatches to
+* its opcode's entry in the mapping ROM, or to its fixed slot
+* OP << OPCODE_SLOT_BITS without one.  Opcode 0 (the idle slot itself)
+* halts the simulation, as does running off the end of the program.
+*/
+
+#define SIM_REGS      8
+#define SIM_MEM_WORDS 0x10000
+
+// macro instruction fields
+#define IR_OP(ir) ((ir) >> 12)
+#define IR_A(ir)  (((ir) >> 8) & 0xf)
+#define IR_B(ir)  (((ir) >> 4) & 0xf)
+#define IR_C(ir)  ((ir) & 0xf)
+
+// why the simulation stopped
+#define SIM_RUNNING     0
+#define SIM_HALT        1   // fetched opcode 0
+#define SIM_END         2   // ran off the end of the program
+#define SIM_CYCLE_LIMIT 3   // max_cycles reached
+
+/**
+* A ROM word decoded once at load time, so execution never has to pull
+* fields out of the instruction.
+*
+* Register operands index a register file laid out as R0..R7, then
+* constIn for each BA, then a sink that absorbs writes with RW=0.
+*/
+typedef struct SimOp
+{
+  uint8_t kind;             // SIM_K_* handler
+  uint8_t a;                // file index of the A bus
+  uint8_t b;                // file index of the B bus
+  uint8_t d;                // file index written, the sink if RW=0
+  uint8_t fs;               // function select
+  uint8_t cond;             // CND of a conditional jump
+  
+  struct SimOp* next;       // fall through successor
+  struct SimOp* target;     // NXT_ADDR of a jump
+  
+  MicroInstruction word;    // the original word, for the slow paths
+}
+SimOp;
+
+#define SIM_FILE_CONSTS 8
+#define SIM_FILE_SINK   16
+#define SIM_FILE_SIZE   17
+
+// handlers: SIM_K_ALU + FS for plain register operations, then
+#define SIM_K_ALU        0
+#define SIM_K_LOAD       16   // R[DA] <- M[A]
+#define SIM_K_STORE      17   // M[A] <- B, R[DA] <- F
+#define SIM_K_LOAD_STORE 18   // both
+#define SIM_K_JUMP       19   // unconditional
+#define SIM_K_BRANCH     20   // conditional on CND
+#define SIM_K_FETCH      21   // the idle word, then fetch and dispatch
+#define SIM_K_COUNT      22
+
+typedef struct DdSim
+{
+  uint16_t regs[SIM_REGS];
+  uint8_t flags;            // COND_P | COND_Z | COND_N from the last F
+  uint32_t upc;             // address of the next ROM word
+  
+  uint16_t ir;              // the macro instruction being executed
+  uint16_t consts[8];       // constIn for each BA: 0, A, B, C, 0...
+  uint32_t pc;              // index of the next macro instruction
+  
+  uint64_t cycles;
+  uint64_t instructions;    // macro instructions dispatched
+  int status;
+  
+  /** control store, padded with zeros to the full depth */
+  MicroInstruction* rom;
+  RomGeometry geom;
+  
+  /** rom decoded by sim_decode, one op per address */
+  SimOp* ops;
+  
+  uint32_t fetch_addr;      // address of the idle word
+  uint32_t dispatch[OPCODE_COUNT];  // entry address of each opcode
+  
+  const uint16_t* program;
+  uint32_t program_len;
+  
+  uint16_t* mem;            // SIM_MEM_WORDS of data memory
+}
+DdSim;
+
+/**
+* Prepares the simulator to run the given control store from the fetch
+* address, dispatching through the given mapping ROM (LexState.opcode_map)
+* or, if it is NULL, to the fixed opcode slots.  Registers and data memory
+* start at zero.  Returns false if there is not enough memory.
+*/
+bool sim_init( DdSim* sim, const MicroInstruction* rom, uint32_t rom_len,
+               const RomGeometry* geom, uint32_t fetch_addr,
+               const uint32_t* dispatch );
+
+void sim_free( DdSim* sim );
+
+/**
+* Decodes every word of the ROM into sim->ops.  sim_init does this; it
+* only needs calling again if the ROM or the fetch address is changed.
+*/
+void sim_decode( DdSim* sim );
+
+/**
+* Sets the macro program; the simulator keeps the pointer, not a copy
+*/
+void sim_load_program( DdSim* sim, const uint16_t* program, uint32_t len );
+
+/**
+* Runs until the program halts or max_cycles more microcycles have
+* executed.  Returns the status.
+*/
+int sim_run( DdSim* sim, uint64_t max_cycles );
+
+/**
+* As sim_run, but one word at a time, counting per ROM address how often
+* each word executed and how often each jump was taken.  Both arrays are
+* geom.depth long and are added to, not cleared.
+*/
+int sim_run_profiled( DdSim* sim, uint64_t max_cycles,
+                      uint64_t* executed, uint64_t* taken );
+
+struct TraceWriter;
+
+/**
+* As sim_run, but one word at a time, recording every cycle into a trace
+* started with trace_begin (trace.h)
+*/
+int sim_run_traced( DdSim* sim, uint64_t max_cycles, struct TraceWriter* trace );
+
+/**
+* Result of the function unit for the given FS and bus values
+*/
+uint16_t sim_function( int fs, uint16_t a, uint16_t b );
+
+/**
+* Reads a Logisim "v2.0 raw" (or bare hex) image of 16-bit words, as
+* used for programs and data memory.  "n*value" runs are expanded.
+* Returns false if the text is not a valid image or does not fit.
+*/
+bool read_word_image( const char* text, size_t len,
+                      uint16_t* words, uint32_t capacity, uint32_t* count );
+
+/**
+* Writes data memory up to its last non-zero word as a Logisim image
+*/
+void write_word_image( FILE* out_file, const uint16_t* words, uint32_t count );
+
+#endif
@@ -0,0 +1,207 @@
+#include "symbols.h"
+#include "binfile.h"
+
+typedef struct SymEntry
+{
+  uint32_t addr;
+  const char* name;
+  uint32_t id;              // in the label table
+  uint32_t index;           // in address order, for the name table
+}
+SymEntry;
+
+static int by_addr( const void* a, const void* b )
+{
+  const SymEntry* x = a;
+  const SymEntry* y = b;
+  if( x->addr != y->addr )
+  {
+    return x->addr < y->addr ? -1 : 1;
+  }
+  return strcmp( x->name, y->name );
+}
+
+static int by_name( const void* a, const void* b )
+{
+  return strcmp( ((const SymEntry*)a)->name, ((const SymEntry*)b)->name );
+}
+
+/**
+* Appends a NUL terminated string to the string table, returns its offset
+*/
+static uint32_t add_string( char* strings, uint32_t* len, const char* str )
+{
+  uint32_t offset = *len;
+  size_t n = strlen( str ) + 1;
+  memcpy( strings + offset, str, n );
+  *len += n;
+  return offset;
+}
+
+void write_symbols( FILE* out_file, LexState state, const char* src_name )
+{
+  LabelTable* table = &state->labels;
+  uint32_t line_count;
+  uint32_t* starts = line_starts( state, &line_count );
+  
+  // everything that can go in: the labels, the source name and ""
+  size_t strings_capacity = table->names_len + strlen( src_name ) + 2;
+  char* strings = malloc( strings_capacity );
+  SymEntry* labels = malloc( (table->count + 1) * sizeof(SymEntry) );
+  uint32_t* label_names = calloc( table->count + 1, sizeof(uint32_t) );
+  uint32_t* order = malloc( (state->section_count + 1) * sizeof(uint32_t) );
+  if( strings == NULL || labels == NULL || label_names == NULL || order == NULL )
+  {
+    free( starts );
+    free( strings );
+    free( labels );
+    free( label_names );
+    free( order );
+    error( "Out of memory", state );
+  }
+  uint32_t strings_len = 0;
+  add_string( strings, &strings_len, "" );
+  uint32_t source = add_string( strings, &strings_len, src_name );
+  
+  uint32_t label_count = 0;
+  uint32_t id;
+  for( id = 0; id < table->count; id++ )
+  {
+    const char* name = table->names + table->labels[id].name;
+    if( table->labels[id].pos >= 0 && name[0] != '.' )
+    {
+      labels[label_count].addr = table->labels[id].pos;
+      labels[label_count].name = name;
+      labels[label_count].id = id;
+      label_count++;
+    }
+  }
+  qsort( labels, label_count, sizeof(SymEntry), by_addr );
+  uint32_t i;
+  for( i = 0; i < label_count; i++ )
+  {
+    label_names[labels[i].id] = add_string( strings, &strings_len, labels[i].name );
+    labels[i].index = i;
+  }
+  
+  uint32_t word_count = 0;
+  uint32_t addr;
+  for( addr = 0; addr < state->rom_used; addr++ )
+  {
+    word_count += state->instr_src[addr] != 0;
+  }
+  
+  // sections in address order, leaving out the empty ones
+  uint32_t section_count = 0;
+  uint32_t s;
+  for( s = 0; s < state->section_count; s++ )
+  {
+    const IrSection* section = &state->sections[s];
+    uint32_t size = 0;
+    for( i = section->first; i < section->first + section->count; i++ )
+    {
+      size += !(state->ir[i].flags & IR_DEAD);
+    }
+    if( size == 0 )
+    {
+      continue;
+    }
+    uint32_t j = section_count++;
+    while( j > 0 && state->sections[order[j - 1]].origin > section->origin )
+    {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = s;
+  }
+  
+  uint32_t labels_offset = SYM_HEADER_SIZE;
+  uint32_t names_offset = labels_offset + label_count * SYM_LABEL_SIZE;
+  uint32_t lines_offset = names_offset + label_count * 4;
+  uint32_t sections_offset = lines_offset + word_count * SYM_LINE_SIZE;
+  uint32_t strings_offset = sections_offset + section_count * SYM_SECTION_SIZE;
+  
+  uint8_t header[SYM_HEADER_SIZE] = { 0 };
+  memcpy( header, SYM_MAGIC, 8 );
+  put_u32( header + 8, state->geom.depth );
+  put_u32( header + 12, label_count );
+  put_u32( header + 16, labels_offset );
+  put_u32( header + 20, names_offset );
+  put_u32( header + 24, word_count );
+  put_u32( header + 28, lines_offset );
+  put_u32( header + 32, section_count );
+  put_u32( header + 36, sections_offset );
+  put_u32( header + 40, strings_offset );
+  put_u32( header + 44, strings_len );
+  put_u32( header + 48, source );
+  fwrite( header, sizeof(header), 1, out_file );
+  
+  uint8_t bytes[SYM_SECTION_SIZE];
+  for( i = 0; i < label_count; i++ )
+  {
+    put_u32( bytes, labels[i].addr );
+    put_u32( bytes + 4, label_names[labels[i].id] );
+    fwrite( bytes, SYM_LABEL_SIZE, 1, out_file );
+  }
+  
+  qsort( labels, label_count, sizeof(SymEntry), by_name );
+  for( i = 0; i < label_count; i++ )
+  {
+    put_u32( bytes, labels[i].index );
+    fwrite( bytes, 4, 1, out_file );
+  }
+  
+  for( addr = 0; addr < state->rom_used; addr++ )
+  {
+    if( state->instr_src[addr] == 0 )
+    {
+      continue;
+    }
+    uint32_t offset = state->instr_src[addr] - 1;
+    uint32_t line = source_line( starts, line_count, offset );
+    put_u32( bytes, addr );
+    put_u32( bytes + 4, line );
+    put_u32( bytes + 8, offset - starts[line - 1] + 1 );
+    fwrite( bytes, SYM_LINE_SIZE, 1, out_file );
+  }
+  
+  for( i = 0; i < section_count; i++ )
+  {
+    const IrSection* section = &state->sections[order[i]];
+    uint32_t size = 0;
+    uint32_t k;
+    for( k = section->first; k < section->first + section->count; k++ )
+    {
+      size += !(state->ir[k].flags & IR_DEAD);
+    }
+    
+    // named after its first label, as in the layout report
+    uint32_t name = 0;
+    uint32_t first = section->first + section->count;
+    for( id = 0; id < table->count; id++ )
+    {
+      uint32_t instr = table->labels[id].instr;
+      if( instr > section->first && instr <= first
+          && table->names[table->labels[id].name] != '.' )
+      {
+        first = instr - 1;
+        name = label_names[id];
+      }
+    }
+    
+    put_u32( bytes, section->origin );
+    put_u32( bytes + 4, size );
+    put_u32( bytes + 8, source_line( starts, line_count, section->src_offset ) );
+    put_u32( bytes + 12, name );
+    put_u32( bytes + 16, section->relocatable );
+    fwrite( bytes, SYM_SECTION_SIZE, 1, out_file );
+  }
+  
+  fwrite( strings, 1, strings_len, out_file );
+  
+  free( starts );
+  free( strings );
+  free( labels );
+  free( label_names );
+  free( order );
+}
@@ -0,0 +1,107 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "assembler.h"
+
+/**
+* Symbol files
+*
+* dda --symbols writes what the assembler knows about the image once the
+* labels are fixed up, so that tools (ddtrace, simulators, debuggers)
+* can name an address without assembling the source again.  The file is
+* a header followed by tables sorted for binary search on a mapping:
+
+  labels      address, name                       by address, then name
+  names       index into labels                   by name
+  lines       address, line, column               by address
+  sections    origin, size, line, name, kind      by origin
+  strings     names, NUL terminated; 0 is ""
+
+* Every field is a little endian uint32_t.  Labels starting with '.' are
+* made up by the assembler (.opcode entries) and left out.
+*/
+
+#define SYM_MAGIC         "DDSYMS1"
+#define SYM_HEADER_SIZE   64
+#define SYM_LABEL_SIZE    8
+#define SYM_LINE_SIZE     12
+#define SYM_SECTION_SIZE  20
+
+/**
+* Writes the symbol file of an assembled source read from src_name
+*/
+void write_symbols( FILE* out_file, LexState state, const char* src_name );
+
+/**
+* A symbol file opened for reading
+*/
+typedef struct SymFile
+{
+  const uint8_t* data;      // the whole file, mapped
+  size_t size;
+  
+  uint32_t depth;
+  uint32_t label_count;
+  uint32_t line_count;
+  uint32_t section_count;
+  
+  const uint8_t* labels;
+  const uint8_t* names;
+  const uint8_t* lines;
+  const uint8_t* sections;
+  const char* strings;
+  uint32_t strings_size;
+  
+  const char* source;       // name of the source file
+}
+SymFile;
+
+/**
+* A section as stored in the file
+*/
+typedef struct SymSection
+{
+  uint32_t origin;
+  uint32_t size;
+  uint32_t line;            // of the .org or .section, 1 if there is none
+  const char* name;         // its first label, or ""
+  bool relocatable;         // a .section rather than a .org
+}
+SymSection;
+
+/**
+* Maps a symbol file.  Returns false if it cannot be read or is not a
+* symbol file, with error set to a message to printf with the path.
+*/
+bool sym_open( SymFile* syms, const char* path, const char** error );
+
+void sym_close( SymFile* syms );
+
+/**
+* Address of the label with the given name, or -1 if there is none
+*/
+int64_t sym_find_label( const SymFile* syms, const char* name );
+
+/**
+* Name of the closest label at or before addr within its section, with
+* offset set to how far addr is past it.  NULL if there is none.
+*/
+const char* sym_label_before( const SymFile* syms, uint32_t addr, uint32_t* offset );
+
+/**
+* Line and column (both from 1) of the instruction at addr.  Returns
+* false if nothing was assembled there.
+*/
+bool sym_line_at( const SymFile* syms, uint32_t addr, uint32_t* line, uint32_t* column );
+
+/**
+* Index of the section holding addr, or -1
+*/
+int64_t sym_section_at( const SymFile* syms, uint32_t addr );
+
+/**
+* Reads section n
+*/
+void sym_section( const SymFile* syms, uint32_t n, SymSection* section );
+
+#endif
@@ -0,0 +1,198 @@
+#include "symbols.h"
+#include "binfile.h"
+
+/**
+* Checks that a table of count entries of size bytes at offset lies
+* within the file, and returns it
+*/
+static const uint8_t* table_at( const SymFile* syms, const uint8_t* header, int field,
+                                uint32_t count, uint32_t size, bool* ok )
+{
+  uint32_t offset = GET_U32( header + field );
+  if( offset > syms->size || count > (syms->size - offset) / size )
+  {
+    *ok = false;
+  }
+  return syms->data + offset;
+}
+
+bool sym_open( SymFile* syms, const char* path, const char** error )
+{
+  memset( syms, 0, sizeof(SymFile) );
+  syms->data = map_file( path, false, &syms->size );
+  if( syms->data == NULL )
+  {
+    *error = "Unable to read %s";
+    return false;
+  }
+  
+  const uint8_t* header = syms->data;
+  if( syms->size < SYM_HEADER_SIZE || memcmp( header, SYM_MAGIC, 8 ) != 0 )
+  {
+    sym_close( syms );
+    *error = "%s is not a symbol file";
+    return false;
+  }
+  syms->depth = GET_U32( header + 8 );
+  syms->label_count = GET_U32( header + 12 );
+  syms->line_count = GET_U32( header + 24 );
+  syms->section_count = GET_U32( header + 32 );
+  syms->strings_size = GET_U32( header + 44 );
+  
+  // everything is looked up without further checks, so check it here
+  bool ok = true;
+  syms->labels = table_at( syms, header, 16, syms->label_count, SYM_LABEL_SIZE, &ok );
+  syms->names = table_at( syms, header, 20, syms->label_count, 4, &ok );
+  syms->lines = table_at( syms, header, 28, syms->line_count, SYM_LINE_SIZE, &ok );
+  syms->sections = table_at( syms, header, 36, syms->section_count, SYM_SECTION_SIZE, &ok );
+  syms->strings = (const char*)table_at( syms, header, 40, syms->strings_size, 1, &ok );
+  uint32_t source = GET_U32( header + 48 );
+  if( !ok || syms->strings_size == 0 || syms->strings[syms->strings_size - 1] != 0
+      || source >= syms->strings_size )
+  {
+    sym_close( syms );
+    *error = "%s is not a symbol file";
+    return false;
+  }
+  syms->source = syms->strings + source;
+  
+  uint32_t i;
+  for( i = 0; i < syms->label_count; i++ )
+  {
+    if( GET_U32( syms->labels + i * SYM_LABEL_SIZE + 4 ) >= syms->strings_size
+        || GET_U32( syms->names + i * 4 ) >= syms->label_count )
+    {
+      ok = false;
+    }
+  }
+  for( i = 0; i < syms->section_count; i++ )
+  {
+    ok &= GET_U32( syms->sections + i * SYM_SECTION_SIZE + 12 ) < syms->strings_size;
+  }
+  if( !ok )
+  {
+    sym_close( syms );
+    *error = "%s is not a symbol file";
+    return false;
+  }
+  return true;
+}
+
+void sym_close( SymFile* syms )
+{
+  if( syms->data != NULL )
+  {
+    unmap_file( syms->data, syms->size );
+  }
+  syms->data = NULL;
+}
+
+/**
+* Index of the last entry of a table sorted by the address in its first
+* field that is at or before addr, or -1
+*/
+static int64_t last_at_or_before( const uint8_t* table, uint32_t count, uint32_t size,
+                                  uint32_t addr )
+{
+  uint32_t lo = 0;
+  uint32_t hi = count;
+  while( lo < hi )
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if( GET_U32( table + mid * size ) <= addr )
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return (int64_t)lo - 1;
+}
+
+int64_t sym_find_label( const SymFile* syms, const char* name )
+{
+  uint32_t lo = 0;
+  uint32_t hi = syms->label_count;
+  while( lo < hi )
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const uint8_t* label = syms->labels + GET_U32( syms->names + mid * 4 ) * SYM_LABEL_SIZE;
+    int cmp = strcmp( syms->strings + GET_U32( label + 4 ), name );
+    if( cmp == 0 )
+    {
+      return GET_U32( label );
+    }
+    if( cmp < 0 )
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return -1;
+}
+
+const char* sym_label_before( const SymFile* syms, uint32_t addr, uint32_t* offset )
+{
+  int64_t n = last_at_or_before( syms->labels, syms->label_count, SYM_LABEL_SIZE, addr );
+  if( n < 0 )
+  {
+    return NULL;
+  }
+  
+  // the first of several labels at the same address
+  const uint8_t* label = syms->labels + n * SYM_LABEL_SIZE;
+  uint32_t label_addr = GET_U32( label );
+  while( n > 0 && GET_U32( label - SYM_LABEL_SIZE ) == label_addr )
+  {
+    label -= SYM_LABEL_SIZE;
+    n--;
+  }
+  
+  // a label from the section before says nothing about this one
+  int64_t s = sym_section_at( syms, addr );
+  if( s >= 0 && label_addr < GET_U32( syms->sections + s * SYM_SECTION_SIZE ) )
+  {
+    return NULL;
+  }
+  *offset = addr - label_addr;
+  return syms->strings + GET_U32( label + 4 );
+}
+
+bool sym_line_at( const SymFile* syms, uint32_t addr, uint32_t* line, uint32_t* column )
+{
+  int64_t n = last_at_or_before( syms->lines, syms->line_count, SYM_LINE_SIZE, addr );
+  if( n < 0 || GET_U32( syms->lines + n * SYM_LINE_SIZE ) != addr )
+  {
+    return false;
+  }
+  const uint8_t* entry = syms->lines + n * SYM_LINE_SIZE;
+  *line = GET_U32( entry + 4 );
+  *column = GET_U32( entry + 8 );
+  return true;
+}
+
+int64_t sym_section_at( const SymFile* syms, uint32_t addr )
+{
+  int64_t n = last_at_or_before( syms->sections, syms->section_count, SYM_SECTION_SIZE, addr );
+  if( n < 0 )
+  {
+    return -1;
+  }
+  const uint8_t* section = syms->sections + n * SYM_SECTION_SIZE;
+  return addr - GET_U32( section ) < GET_U32( section + 4 ) ? n : -1;
+}
+
+void sym_section( const SymFile* syms, uint32_t n, SymSection* section )
+{
+  const uint8_t* entry = syms->sections + n * SYM_SECTION_SIZE;
+  section->origin = GET_U32( entry );
+  section->size = GET_U32( entry + 4 );
+  section->line = GET_U32( entry + 8 );
+  section->name = syms->strings + GET_U32( entry + 12 );
+  section->relocatable = GET_U32( entry + 16 ) != 0;
+}
@@ -0,0 +1,298 @@
+#include "trace.h"
+#include "binfile.h"
+
+bool trace_begin( TraceWriter* trace, FILE* file, const DdSim* sim )
+{
+  memset( trace, 0, sizeof(TraceWriter) );
+  trace->file = file;
+  trace->depth = sim->geom.depth;
+  trace->fetch_addr = sim->fetch_addr;
+  memcpy( trace->dispatch, sim->dispatch, sizeof(trace->dispatch) );
+  
+  trace->buffer = malloc( TRACE_BUFFER_RECORDS * sizeof(uint32_t) );
+  if( trace->buffer == NULL )
+  {
+    return false;
+  }
+  
+  // the header is filled in by trace_finish, once the counts are known
+  uint8_t header[TRACE_HEADER_SIZE] = { 0 };
+  trace->failed = fwrite( header, sizeof(header), 1, file ) != 1;
+  return true;
+}
+
+void trace_flush( TraceWriter* trace )
+{
+  uint8_t bytes[4 * 1024];
+  uint32_t i = 0;
+  while( i < trace->used )
+  {
+    uint32_t n = 0;
+    for( ; i < trace->used && n < sizeof(bytes); i++, n += 4 )
+    {
+      put_u32( bytes + n, trace->buffer[i] );
+    }
+    if( fwrite( bytes, 1, n, trace->file ) != n )
+    {
+      trace->failed = true;
+    }
+  }
+  trace->used = 0;
+}
+
+bool trace_keyframe( TraceWriter* trace, const uint16_t* regs, uint8_t flags,
+                     uint32_t upc, uint16_t ir, uint32_t pc )
+{
+  if( trace->keyframe_count == trace->keyframe_capacity )
+  {
+    uint64_t capacity = trace->keyframe_capacity == 0 ? 64 : trace->keyframe_capacity * 2;
+    TraceState* keyframes = realloc( trace->keyframes, capacity * sizeof(TraceState) );
+    if( keyframes == NULL )
+    {
+      return false;
+    }
+    trace->keyframes = keyframes;
+    trace->keyframe_capacity = capacity;
+  }
+  
+  TraceState* key = &trace->keyframes[trace->keyframe_count++];
+  key->cycle = trace->cycles;
+  key->record = trace->records;
+  key->upc = upc;
+  key->pc = pc;
+  key->ir = ir;
+  memcpy( key->regs, regs, sizeof(key->regs) );
+  key->flags = flags;
+  return true;
+}
+
+bool trace_finish( TraceWriter* trace )
+{
+  trace_flush( trace );
+  
+  uint64_t i;
+  for( i = 0; i < trace->keyframe_count; i++ )
+  {
+    const TraceState* key = &trace->keyframes[i];
+    uint8_t bytes[TRACE_KEYFRAME_SIZE] = { 0 };
+    put_u64( bytes, key->cycle );
+    put_u64( bytes + 8, key->record );
+    put_u32( bytes + 16, key->upc );
+    put_u32( bytes + 20, key->pc );
+    put_u16( bytes + 24, key->ir );
+    int r;
+    for( r = 0; r < SIM_REGS; r++ )
+    {
+      put_u16( bytes + 26 + 2 * r, key->regs[r] );
+    }
+    bytes[42] = key->flags;
+    if( fwrite( bytes, sizeof(bytes), 1, trace->file ) != 1 )
+    {
+      trace->failed = true;
+    }
+  }
+  
+  uint8_t header[TRACE_HEADER_SIZE] = { 0 };
+  memcpy( header, TRACE_MAGIC, 8 );
+  put_u64( header + 8, trace->records );
+  put_u64( header + 16, trace->cycles );
+  put_u64( header + 24, TRACE_HEADER_SIZE + trace->records * 4 );
+  put_u64( header + 32, trace->keyframe_count );
+  put_u32( header + 40, TRACE_INTERVAL );
+  put_u32( header + 44, trace->depth );
+  put_u32( header + 48, trace->fetch_addr );
+  int op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    put_u32( header + 52 + 4 * op, trace->dispatch[op] );
+  }
+  if( fseek( trace->file, 0, SEEK_SET ) != 0
+      || fwrite( header, sizeof(header), 1, trace->file ) != 1 )
+  {
+    trace->failed = true;
+  }
+  
+  free( trace->buffer );
+  free( trace->keyframes );
+  return !trace->failed;
+}
+
+bool trace_open( TraceFile* trace, const char* path, const char** error )
+{
+  memset( trace, 0, sizeof(TraceFile) );
+  trace->data = map_file( path, true, &trace->size );
+  if( trace->data == NULL )
+  {
+    *error = "Unable to read %s";
+    return false;
+  }
+  
+  const uint8_t* header = trace->data;
+  if( trace->size < TRACE_HEADER_SIZE || memcmp( header, TRACE_MAGIC, 8 ) != 0 )
+  {
+    trace_close( trace );
+    *error = "%s is not a trace";
+    return false;
+  }
+  trace->records = GET_U64( header + 8 );
+  trace->cycles = GET_U64( header + 16 );
+  trace->keyframe_offset = GET_U64( header + 24 );
+  trace->keyframe_count = GET_U64( header + 32 );
+  trace->interval = GET_U32( header + 40 );
+  trace->depth = GET_U32( header + 44 );
+  trace->fetch_addr = GET_U32( header + 48 );
+  int op;
+  for( op = 0; op < OPCODE_COUNT; op++ )
+  {
+    trace->dispatch[op] = GET_U32( header + 52 + 4 * op );
+  }
+  
+  // a trace cut short (the run was killed before trace_finish) has no
+  // counts, and anything that does not add up is not read at all
+  if( trace->keyframe_count == 0 || trace->interval == 0 || trace->depth == 0
+      || trace->keyframe_offset != TRACE_HEADER_SIZE + trace->records * 4
+      || trace->keyframe_offset > trace->size
+      || trace->keyframe_count > (trace->size - trace->keyframe_offset) / TRACE_KEYFRAME_SIZE )
+  {
+    trace_close( trace );
+    *error = "%s is incomplete, the run did not finish";
+    return false;
+  }
+  return true;
+}
+
+void trace_close( TraceFile* trace )
+{
+  if( trace->data != NULL )
+  {
+    unmap_file( trace->data, trace->size );
+  }
+  trace->data = NULL;
+}
+
+/**
+* Loads keyframe n
+*/
+static void read_keyframe( const TraceFile* trace, uint64_t n, TraceState* state )
+{
+  const uint8_t* bytes = trace->data + trace->keyframe_offset + n * TRACE_KEYFRAME_SIZE;
+  state->cycle = GET_U64( bytes );
+  state->record = GET_U64( bytes + 8 );
+  state->upc = GET_U32( bytes + 16 );
+  state->pc = GET_U32( bytes + 20 );
+  state->ir = GET_U16( bytes + 24 );
+  int r;
+  for( r = 0; r < SIM_REGS; r++ )
+  {
+    state->regs[r] = GET_U16( bytes + 26 + 2 * r );
+  }
+  state->flags = bytes[42];
+}
+
+static uint32_t record_at( const TraceFile* trace, uint64_t record )
+{
+  return GET_U32( trace->data + TRACE_HEADER_SIZE + record * 4 );
+}
+
+void trace_seek( const TraceFile* trace, uint64_t cycle, TraceState* state )
+{
+  // keyframes are every interval cycles from the start
+  uint64_t n = cycle / trace->interval;
+  if( n >= trace->keyframe_count )
+  {
+    n = trace->keyframe_count - 1;
+  }
+  read_keyframe( trace, n, state );
+  
+  TraceStep step;
+  while( state->cycle < cycle && trace_step( trace, state, &step ) )
+  {
+  }
+  
+  // a FETCH after the last record belongs to the cycle before
+  while( state->record < trace->records
+         && TRACE_KIND( record_at( trace, state->record ) ) == TRACE_FETCH )
+  {
+    trace_step( trace, state, &step );
+  }
+}
+
+void trace_seek_record( const TraceFile* trace, uint64_t record, TraceState* state )
+{
+  // the last keyframe at or before record
+  uint64_t lo = 0;
+  uint64_t hi = trace->keyframe_count;
+  while( hi - lo > 1 )
+  {
+    uint64_t mid = lo + (hi - lo) / 2;
+    const uint8_t* bytes = trace->data + trace->keyframe_offset + mid * TRACE_KEYFRAME_SIZE;
+    if( GET_U64( bytes + 8 ) <= record )
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  read_keyframe( trace, lo, state );
+}
+
+bool trace_step( const TraceFile* trace, TraceState* state, TraceStep* step )
+{
+  if( state->record >= trace->records )
+  {
+    return false;
+  }
+  uint32_t r = record_at( trace, state->record );
+  state->record++;
+  
+  memset( step, 0, sizeof(TraceStep) );
+  step->kind = TRACE_KIND( r );
+  step->reg = -1;
+  
+  if( step->kind == TRACE_FETCH )
+  {
+    // belongs to the cycle of the idle word, which has been counted
+    step->cycle = state->cycle - 1;
+    step->ir = (uint16_t)r;
+    step->upc = trace->dispatch[IR_OP( step->ir )];
+    step->flags = state->flags;
+    state->ir = step->ir;
+    state->pc++;
+    state->upc = step->upc;
+    step->next = step->upc;
+    return true;
+  }
+  
+  step->cycle = state->cycle++;
+  step->upc = state->upc;
+  if( step->kind == TRACE_JUMP )
+  {
+    step->taken = (r >> 29) & 1;
+    step->flags = state->flags;
+    state->upc = r & 0x1fffffff;
+    step->next = state->upc;
+    return true;
+  }
+  
+  // the B bus is a register or constIn, which comes from IR
+  step->store = step->kind == TRACE_STORE;
+  if( step->store )
+  {
+    uint16_t consts[8] = { 0, IR_A( state->ir ), IR_B( state->ir ), IR_C( state->ir ) };
+    uint32_t b = (r >> 16) & 0xf;
+    step->mem_addr = state->regs[(r >> 20) & 0x7];
+    step->mem_value = b < SIM_FILE_CONSTS ? state->regs[b] : consts[b - SIM_FILE_CONSTS];
+  }
+  if( (r >> 26) & 1 )
+  {
+    step->reg = (r >> 23) & 0x7;
+    step->value = (uint16_t)r;
+    state->regs[step->reg] = step->value;
+  }
+  step->flags = state->flags = (r >> 27) & 0x7;
+  state->upc = state->upc + 1 < trace->depth ? state->upc + 1 : 0;
+  step->next = state->upc;
+  return true;
+}
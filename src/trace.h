@@ -0,0 +1,202 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "sim.h"
+
+/**
+* Execution traces
+*
+* dda --sim --trace records every microcycle of a run as one 32-bit
+* record, so a trace of a billion cycles is about 4.7 GB.  Records only
+* hold what the cycle changed that cannot be worked out from the state
+* before it; a reader replays them from a keyframe of the full state:
+
+  OP      [31:30] 0   [29:27] PZN   [26] RW   [25:23] DA   [15:0] value
+          a micro operation, the value is what R[DA] was set to
+  STORE   [31:30] 1   as OP, plus [22:20] AA and [19:16] the file index
+          of the B bus (SimOp.b): M[R[AA]] <- B, from the registers and
+          constIn before the cycle
+  JUMP    [31:30] 2   [29] taken   [28:0] address of the next word
+  FETCH   [31:30] 3   [15:0] the macro instruction loaded into IR, after
+          the record of the idle word; not a cycle of its own
+
+* The word of every cycle is the one after the previous (wrapping at the
+* depth of the control store), the one a JUMP went to, or the opcode
+* entry of a FETCH.
+*
+* A keyframe of the registers, flags and addresses is kept every
+* interval cycles, so seeking to a cycle replays less than an interval.
+* The file is the header, the records and the keyframes, all little
+* endian, and is read through a memory mapping rather than loaded.
+*/
+
+#define TRACE_MAGIC           "DDTRACE1"
+#define TRACE_HEADER_SIZE     128
+#define TRACE_KEYFRAME_SIZE   48
+#define TRACE_INTERVAL        65536
+#define TRACE_BUFFER_RECORDS  65536
+
+// record kinds
+#define TRACE_OP    0
+#define TRACE_STORE 1
+#define TRACE_JUMP  2
+#define TRACE_FETCH 3
+
+#define TRACE_KIND(r)   ((r) >> 30)
+
+#define TRACE_OP_RECORD( flags, rw, d, value ) \
+  (((uint32_t)(flags) << 27) | ((uint32_t)(rw) << 26) | ((uint32_t)(d) << 23) | (value))
+#define TRACE_STORE_RECORD( flags, rw, d, value, a, b ) \
+  (((uint32_t)TRACE_STORE << 30) | TRACE_OP_RECORD( flags, rw, d, value ) \
+   | ((uint32_t)(a) << 20) | ((uint32_t)(b) << 16))
+#define TRACE_JUMP_RECORD( taken, addr ) \
+  (((uint32_t)TRACE_JUMP << 30) | ((uint32_t)(taken) << 29) | (addr))
+#define TRACE_FETCH_RECORD( ir ) \
+  (((uint32_t)TRACE_FETCH << 30) | (ir))
+
+/**
+* Machine state at a point in a trace: before cycle, whose first record
+* is record
+*/
+typedef struct TraceState
+{
+  uint64_t cycle;
+  uint64_t record;
+  uint32_t upc;             // address of the word about to run
+  uint32_t pc;              // index of the next macro instruction
+  uint16_t ir;
+  uint16_t regs[SIM_REGS];
+  uint8_t flags;
+}
+TraceState;
+
+/**
+* Writes a trace as the simulator runs
+*/
+typedef struct TraceWriter
+{
+  FILE* file;
+  uint32_t* buffer;         // TRACE_BUFFER_RECORDS not yet written
+  uint32_t used;
+  bool failed;              // a write went wrong, reported by trace_finish
+  
+  uint64_t records;
+  uint64_t cycles;
+  
+  TraceState* keyframes;
+  uint64_t keyframe_count;
+  uint64_t keyframe_capacity;
+  
+  uint32_t depth;
+  uint32_t fetch_addr;
+  uint32_t dispatch[OPCODE_COUNT];
+}
+TraceWriter;
+
+/**
+* Starts a trace of the given simulator in file, which must be open for
+* binary writing and seekable.  Returns false if there is not enough memory.
+*/
+bool trace_begin( TraceWriter* trace, FILE* file, const DdSim* sim );
+
+/**
+* Writes out the buffered records
+*/
+void trace_flush( TraceWriter* trace );
+
+/**
+* Appends a record; a FETCH is not counted as a cycle
+*/
+#define trace_put( trace, record ) \
+  do \
+  { \
+    if( (trace)->used == TRACE_BUFFER_RECORDS ) \
+    { \
+      trace_flush( trace ); \
+    } \
+    (trace)->buffer[(trace)->used++] = (record); \
+    (trace)->records++; \
+  } \
+  while( 0 )
+
+/**
+* Records the state before the next cycle as a keyframe.  Returns false
+* if there is not enough memory.
+*/
+bool trace_keyframe( TraceWriter* trace, const uint16_t* regs, uint8_t flags,
+                     uint32_t upc, uint16_t ir, uint32_t pc );
+
+/**
+* Writes the remaining records, the keyframes and the header, and frees
+* the writer.  Returns false if anything could not be written.
+*/
+bool trace_finish( TraceWriter* trace );
+
+/**
+* A trace opened for reading
+*/
+typedef struct TraceFile
+{
+  const uint8_t* data;      // the whole file, mapped
+  size_t size;
+  
+  uint64_t records;
+  uint64_t cycles;
+  uint64_t keyframe_count;
+  uint64_t keyframe_offset;
+  uint32_t interval;
+  uint32_t depth;
+  uint32_t fetch_addr;
+  uint32_t dispatch[OPCODE_COUNT];
+}
+TraceFile;
+
+/**
+* One decoded record, with the memory write worked out from the state
+*/
+typedef struct TraceStep
+{
+  int kind;                 // TRACE_*
+  uint64_t cycle;           // the cycle, or for a FETCH the one it follows
+  uint32_t upc;             // address of the word, the entry for a FETCH
+  uint32_t next;            // address of the word after it
+  uint8_t flags;
+  
+  int reg;                  // register written, or -1
+  uint16_t value;
+  
+  bool store;
+  uint16_t mem_addr;
+  uint16_t mem_value;
+  
+  bool taken;               // JUMP
+  uint16_t ir;              // FETCH
+}
+TraceStep;
+
+/**
+* Maps a trace file.  Returns false if it cannot be read or is not a
+* trace, with error set to a message to printf with the path.
+*/
+bool trace_open( TraceFile* trace, const char* path, const char** error );
+
+void trace_close( TraceFile* trace );
+
+/**
+* Sets state to just before the given cycle, from the closest keyframe.
+* A cycle past the end gives the state at the end.
+*/
+void trace_seek( const TraceFile* trace, uint64_t cycle, TraceState* state );
+
+/**
+* Decodes the record at state->record and moves state past it.  Returns
+* false at the end of the trace.
+*/
+bool trace_step( const TraceFile* trace, TraceState* state, TraceStep* step );
+
+/**
+* Sets state to the keyframe before the given record
+*/
+void trace_seek_record( const TraceFile* trace, uint64_t record, TraceState* state );
+
+#endif
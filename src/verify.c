@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+
+#include "verify.h"
+
+// memory operands of an instruction, inside the window
+#define MEM_A( ir ) (IR_A( ir ) % SIM_LANE_MEM)
+#define MEM_B( ir ) (IR_B( ir ) % SIM_LANE_MEM)
+#define MEM_C( ir ) (IR_C( ir ) % SIM_LANE_MEM)
+
+static void model_store( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = IR_B( ir );
+}
+
+static void model_copy( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )];
+}
+
+static void model_add( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )] + mem[MEM_C( ir )];
+}
+
+static void model_sub( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )] - mem[MEM_C( ir )];
+}
+
+static void model_mul( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )] * mem[MEM_C( ir )];
+}
+
+static void model_shift( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )] >> 1;
+}
+
+static void model_not( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = ~mem[MEM_B( ir )];
+}
+
+static void model_and( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_B( ir )] & mem[MEM_C( ir )];
+}
+
+static void model_copy_if_zero( uint16_t ir, uint16_t* mem )
+{
+  if( mem[MEM_C( ir )] == 0 )
+  {
+    mem[MEM_A( ir )] = mem[MEM_B( ir )];
+  }
+}
+
+static void model_compare( uint16_t ir, uint16_t* mem )
+{
+  mem[MEM_A( ir )] = mem[MEM_C( ir )] == mem[MEM_B( ir )] ? 0 : 1;
+}
+
+/**
+* The documented meaning of each opcode in micro.asm
+*/
+static const struct
+{
+  GoldenModel model;
+  const char* description;
+}
+GOLDEN[16] = {
+  { NULL,               NULL },
+  { model_store,        "M[A] <- B" },
+  { model_copy,         "M[A] <- M[B]" },
+  { model_add,          "M[A] <- M[B] + M[C]" },
+  { model_sub,          "M[A] <- M[B] - M[C]" },
+  { model_mul,          "M[A] <- M[B] * M[C]" },
+  { model_shift,        "M[A] <- M[B] >> 1" },
+  { model_not,          "M[A] <- NOT(M[B])" },
+  { model_and,          "M[A] <- M[B] AND M[C]" },
+  { model_copy_if_zero, "IF(M[C]=0) THEN M[A] <- M[B]" },
+  { model_compare,      "IF(M[C] = M[B]) THEN (M[A] <- 0) ELSE (M[A] <- 1)" }
+};
+
+GoldenModel golden_model( int opcode, const char** description )
+{
+  if( opcode < 0 || opcode > 15 )
+  {
+    return NULL;
+  }
+  if( description != NULL )
+  {
+    *description = GOLDEN[opcode].description;
+  }
+  return GOLDEN[opcode].model;
+}
+
+static const uint16_t EDGE_VALUES[] = { 0, 1, 2, 0x7ffe, 0x7fff, 0x8000, 0x8001, 0xffff };
+
+#define EDGE_COUNT  (sizeof(EDGE_VALUES) / sizeof(EDGE_VALUES[0]))
+#define STRATA      16
+
+// chunks of SIM_LANES inputs taken from a range at a time
+#define VERIFY_GRAIN 64
+
+/**
+* The numbered inputs for one opcode
+*/
+typedef struct VerifySpace
+{
+  int opcode;
+  GoldenModel model;
+  
+  bool exhaustive;
+  uint16_t operands;
+  
+  uint16_t* values;         // for M[B] and M[C] when stratified
+  uint32_t value_count;
+  
+  uint64_t inputs;
+}
+VerifySpace;
+
+static uint64_t mix( uint64_t z )
+{
+  // splitmix64 finaliser
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void input_at( const VerifySpace* space, uint64_t index,
+                      uint16_t* ir, uint16_t mem[SIM_LANE_MEM] )
+{
+  uint32_t operands;
+  uint16_t x;
+  uint16_t y;
+  if( space->exhaustive )
+  {
+    operands = space->operands;
+    x = (uint16_t)(index >> 16);
+    y = (uint16_t)index;
+  }
+  else
+  {
+    uint64_t n = space->value_count;
+    y = space->values[index % n];
+    x = space->values[(index / n) % n];
+    operands = (uint32_t)(index / n / n);
+  }
+  
+  *ir = (uint16_t)((space->opcode << 12) | (operands & 0xfff));
+  
+  int w;
+  for( w = 0; w < SIM_LANE_MEM; w++ )
+  {
+    mem[w] = (uint16_t)mix( index * SIM_LANE_MEM + w );
+  }
+  mem[MEM_B( *ir )] = x;
+  mem[MEM_C( *ir )] = y;
+}
+
+/**
+* A worker's remaining range of chunks; others steal from its end
+*/
+typedef struct VerifyWorker
+{
+  pthread_mutex_t lock;
+  uint64_t begin;
+  uint64_t end;
+  
+  int index;
+  struct VerifyPool* pool;
+}
+VerifyWorker;
+
+typedef struct VerifyPool
+{
+  const DdSim* sim;
+  const VerifySpace* space;
+  uint64_t max_cycles;
+  
+  VerifyWorker* workers;
+  int count;
+  
+  pthread_mutex_t lock;     // guards the rest
+  uint64_t first_mismatch;  // input index, UINT64_MAX if none yet
+  uint64_t inputs_run;
+  VerifyResult* result;
+}
+VerifyPool;
+
+/**
+* Takes up to VERIFY_GRAIN chunks from the worker's own range, or steals
+* the back half of another worker's.  Returns false once there is no
+* work left anywhere.
+*/
+static bool take_chunks( VerifyWorker* worker, uint64_t* begin, uint64_t* end )
+{
+  VerifyPool* pool = worker->pool;
+  while( true )
+  {
+    pthread_mutex_lock( &worker->lock );
+    if( worker->begin < worker->end )
+    {
+      *begin = worker->begin;
+      *end = worker->end - worker->begin > VERIFY_GRAIN ? worker->begin + VERIFY_GRAIN : worker->end;
+      worker->begin = *end;
+      pthread_mutex_unlock( &worker->lock );
+      return true;
+    }
+    pthread_mutex_unlock( &worker->lock );
+    
+    bool stole = false;
+    int i;
+    for( i = 1; i < pool->count && !stole; i++ )
+    {
+      VerifyWorker* victim = &pool->workers[(worker->index + i) % pool->count];
+      uint64_t from = 0;
+      uint64_t to = 0;
+      
+      pthread_mutex_lock( &victim->lock );
+      if( victim->begin < victim->end )
+      {
+        from = victim->begin + (victim->end - victim->begin) / 2;
+        to = victim->end;
+        victim->end = from;
+        stole = true;
+      }
+      pthread_mutex_unlock( &victim->lock );
+      
+      if( stole )
+      {
+        pthread_mutex_lock( &worker->lock );
+        worker->begin = from;
+        worker->end = to;
+        pthread_mutex_unlock( &worker->lock );
+      }
+    }
+    if( !stole )
+    {
+      return false;
+    }
+  }
+}
+
+/**
+* Runs SIM_LANES inputs starting at chunk * SIM_LANES and records any
+* mismatch.  Returns the number of inputs run.
+*/
+static uint64_t run_chunk( VerifyPool* pool, uint64_t chunk, DdLanes* lanes )
+{
+  const VerifySpace* space = pool->space;
+  uint64_t first = chunk * SIM_LANES;
+  uint16_t ir[SIM_LANES];
+  uint16_t initial[SIM_LANES][SIM_LANE_MEM];
+  int count = 0;
+  int l;
+  int w;
+  
+  memset( lanes, 0, sizeof(DdLanes) );
+  for( l = 0; l < SIM_LANES; l++ )
+  {
+    ir[l] = 0;
+    if( first + l < space->inputs )
+    {
+      input_at( space, first + l, &ir[l], initial[l] );
+      for( w = 0; w < SIM_LANE_MEM; w++ )
+      {
+        lanes->mem[w][l] = initial[l][w];
+      }
+      count++;
+    }
+  }
+  
+  lanes_start( lanes, pool->sim, ir );
+  lanes_run( lanes, pool->sim, pool->max_cycles );
+  
+  for( l = 0; l < count; l++ )
+  {
+    uint16_t expected[SIM_LANE_MEM];
+    memcpy( expected, initial[l], sizeof(expected) );
+    space->model( ir[l], expected );
+    
+    bool same = lanes->status[l] == SIM_END;
+    for( w = 0; w < SIM_LANE_MEM; w++ )
+    {
+      same = same && lanes->mem[w][l] == expected[w];
+    }
+    if( same )
+    {
+      continue;
+    }
+    
+    pthread_mutex_lock( &pool->lock );
+    if( first + l < pool->first_mismatch )
+    {
+      VerifyResult* result = pool->result;
+      pool->first_mismatch = first + l;
+      result->mismatch = true;
+      result->ir = ir[l];
+      result->status = lanes->status[l];
+      memcpy( result->initial, initial[l], sizeof(result->initial) );
+      memcpy( result->expected, expected, sizeof(result->expected) );
+      for( w = 0; w < SIM_LANE_MEM; w++ )
+      {
+        result->actual[w] = lanes->mem[w][l];
+      }
+    }
+    pthread_mutex_unlock( &pool->lock );
+    
+    // later lanes in the chunk can only be later mismatches
+    break;
+  }
+  
+  return count;
+}
+
+static void* verify_worker( void* arg )
+{
+  VerifyWorker* worker = arg;
+  VerifyPool* pool = worker->pool;
+  DdLanes lanes;
+  uint64_t inputs_run = 0;
+  uint64_t begin;
+  uint64_t end;
+  
+  while( take_chunks( worker, &begin, &end ) )
+  {
+    // nothing past a mismatch already found needs running
+    pthread_mutex_lock( &pool->lock );
+    uint64_t limit = pool->first_mismatch;
+    pthread_mutex_unlock( &pool->lock );
+    
+    uint64_t chunk;
+    for( chunk = begin; chunk < end && chunk * SIM_LANES < limit; chunk++ )
+    {
+      inputs_run += run_chunk( pool, chunk, &lanes );
+    }
+  }
+  
+  pthread_mutex_lock( &pool->lock );
+  pool->inputs_run += inputs_run;
+  pthread_mutex_unlock( &pool->lock );
+  return NULL;
+}
+
+bool verify_opcode( const DdSim* sim, int opcode, const VerifyOptions* opts,
+                    VerifyResult* result )
+{
+  memset( result, 0, sizeof(VerifyResult) );
+  
+  VerifySpace space;
+  memset( &space, 0, sizeof(space) );
+  space.opcode = opcode;
+  space.model = golden_model( opcode, NULL );
+  if( space.model == NULL )
+  {
+    return false;
+  }
+  
+  space.exhaustive = opts->exhaustive;
+  space.operands = opts->operands;
+  if( space.exhaustive )
+  {
+    space.inputs = (uint64_t)1 << 32;
+  }
+  else
+  {
+    // edge values, then random values from each stratum of the range
+    int samples = opts->samples > 0 ? opts->samples : 0;
+    space.values = malloc( (EDGE_COUNT + STRATA * samples) * sizeof(uint16_t) );
+    if( space.values == NULL )
+    {
+      return false;
+    }
+    memcpy( space.values, EDGE_VALUES, sizeof(EDGE_VALUES) );
+    space.value_count = EDGE_COUNT;
+    
+    int stratum;
+    int s;
+    for( stratum = 0; stratum < STRATA; stratum++ )
+    {
+      for( s = 0; s < samples; s++ )
+      {
+        uint16_t offset = (uint16_t)mix( (uint64_t)stratum * samples + s ) % (0x10000 / STRATA);
+        space.values[space.value_count++] = (uint16_t)(stratum * (0x10000 / STRATA) + offset);
+      }
+    }
+    space.inputs = (uint64_t)0x1000 * space.value_count * space.value_count;
+  }
+  
+  int threads = opts->threads > 0 ? opts->threads : 1;
+  uint64_t chunks = (space.inputs + SIM_LANES - 1) / SIM_LANES;
+  
+  VerifyPool pool;
+  pool.sim = sim;
+  pool.space = &space;
+  pool.max_cycles = opts->max_cycles;
+  pool.workers = calloc( threads, sizeof(VerifyWorker) );
+  pool.count = threads;
+  pool.first_mismatch = UINT64_MAX;
+  pool.inputs_run = 0;
+  pool.result = result;
+  pthread_mutex_init( &pool.lock, NULL );
+  if( pool.workers == NULL )
+  {
+    free( space.values );
+    return false;
+  }
+  
+  // start with an even split, stealing evens out the rest
+  int i;
+  for( i = 0; i < threads; i++ )
+  {
+    VerifyWorker* worker = &pool.workers[i];
+    pthread_mutex_init( &worker->lock, NULL );
+    worker->begin = chunks * i / threads;
+    worker->end = chunks * (i + 1) / threads;
+    worker->index = i;
+    worker->pool = &pool;
+  }
+  
+  // the calling thread is worker 0
+  pthread_t* handles = malloc( threads * sizeof(pthread_t) );
+  int started = 0;
+  while( handles != NULL && started < threads - 1 )
+  {
+    if( pthread_create( &handles[started], NULL, verify_worker, &pool.workers[started + 1] ) != 0 )
+    {
+      break;
+    }
+    started++;
+  }
+  
+  verify_worker( &pool.workers[0] );
+  
+  for( i = 0; i < started; i++ )
+  {
+    pthread_join( handles[i], NULL );
+  }
+  
+  // workers that never started leave their range for the others to
+  // steal, so everything has run by the time worker 0 returns
+  result->inputs = pool.inputs_run;
+  
+  for( i = 0; i < threads; i++ )
+  {
+    pthread_mutex_destroy( &pool.workers[i].lock );
+  }
+  pthread_mutex_destroy( &pool.lock );
+  free( handles );
+  free( pool.workers );
+  free( space.values );
+  return true;
+}
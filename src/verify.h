@@ -0,0 +1,76 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "lanes.h"
+
+/**
+* Verification of macro opcodes against golden models
+*
+* Each opcode of the DDmini instruction set implemented by micro.asm has
+* a C model of its documented effect on memory.  verify_opcode runs the
+* microcode for the opcode in lockstep lanes over a space of inputs and
+* compares the memory window each lane ends with against the model.
+* Registers are scratch and are not compared.
+*
+* The input space is either
+*   stratified: every combination of the A, B and C fields, with M[B]
+*               and M[C] each taking the edge values (0, 1, 2, 7ffe,
+*               7fff, 8000, 8001, ffff) plus `samples` random values
+*               from each sixteenth of the 16-bit range, or
+*   exhaustive: one combination of the A, B and C fields, with every
+*               pair of 16-bit values for M[B] and M[C].
+* The rest of the memory window is filled with a pattern that differs
+* per input, so stray writes are caught too.  The window is only the
+* lowest SIM_LANE_MEM words (see lanes.h): an input whose microcode
+* addresses memory past it is a mismatch with status SIM_OUT_OF_WINDOW,
+* so opcodes that use other memory cannot be verified this way.
+*
+* Inputs are numbered, and the work is split into ranges over a pool of
+* threads that steal half of each other's remaining range when they run
+* out.  The mismatch reported is the lowest numbered one.
+*/
+
+/**
+* Golden model: applies an instruction to a SIM_LANE_MEM word memory
+*/
+typedef void (*GoldenModel)( uint16_t ir, uint16_t* mem );
+
+typedef struct VerifyOptions
+{
+  int samples;              // random values per stratum
+  bool exhaustive;
+  uint16_t operands;        // the A, B and C fields when exhaustive
+  int threads;
+  uint64_t max_cycles;      // per input, before it counts as a hang
+}
+VerifyOptions;
+
+typedef struct VerifyResult
+{
+  uint64_t inputs;          // inputs run
+  bool mismatch;
+  
+  // the first mismatching input, when there is one
+  uint16_t ir;
+  int status;               // SIM_END, SIM_CYCLE_LIMIT if it hung or
+                            // SIM_OUT_OF_WINDOW
+  uint16_t initial[SIM_LANE_MEM];
+  uint16_t expected[SIM_LANE_MEM];
+  uint16_t actual[SIM_LANE_MEM];
+}
+VerifyResult;
+
+/**
+* Returns the golden model of an opcode, or NULL if it has none.
+* description is set to its documented meaning.
+*/
+GoldenModel golden_model( int opcode, const char** description );
+
+/**
+* Verifies one opcode of the control store decoded in sim.  Returns
+* false if the opcode has no golden model.
+*/
+bool verify_opcode( const DdSim* sim, int opcode, const VerifyOptions* opts,
+                    VerifyResult* result );
+
+#endif
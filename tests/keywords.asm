@@ -0,0 +1,45 @@
+; every reserved word, in either case, next to labels that start with x
+; or with a reserved word and so must not be taken for one
+idle: nop
+xnop: NOP
+xmov:
+ mov r0 a
+ MOV r1 B
+ mov r2 c
+ mov r3 0
+ mov r4 1
+ mov r5 [r6]
+ mov [r7] r0
+ mov [r1] A
+ add r1 r2 r3
+ sub r2 r3 r4
+ mul r3 r4 r5
+ div r4 r5 r6
+ and r5 r6 r7
+ or r6 r7 r0
+ not r7 r0
+ nadd r0 r1
+ rsh r1 r2
+ lsh r2 r3
+ sar r3 r4
+xjmp:
+ jmp xor
+ jmpp xnop
+ jmpz xmov
+ jmpn xjmp
+ jmppz movx
+ jmppn jmpx
+ JMPZN idle
+ jmppzn x00
+xor: nop
+movx: nop
+jmpx: jmp idle
+
+.org x40
+.opcode x5
+ jmp xsection
+
+.section
+xsection:
+ mov r0 r1
+ jmp idle
@@ -0,0 +1,14 @@
+xyz: nop
+; labels may start with x as long as a hex digit does not follow it,
+; including the very first token of the file
+ jmp xyz
+ jmp xray
+ jmp x10
+xray:
+ mov r0 r1
+ jmpz xyz
+
+.org x10
+xylo:
+ jmp xray
+ jmp xylo